@@ -5,7 +5,7 @@
 #-------------------------------------------------
 
 QT       += core gui
-QT += charts
+QT += charts network
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -31,14 +31,19 @@ SOURCES += \
     datagraph.cpp \
     chartview.cpp \
     chart.cpp \
-    motormodel.cpp
+    serieslod.cpp \
+    logstream.cpp
 
 HEADERS += \
         mainwindow.h \
     datagraph.h \
     chartview.h \
     chart.h \
-    motormodel.h
+    serieslod.h \
+    tunejob.h \
+    logstream.h
+
+include(core.pri)
 
 FORMS += \
         mainwindow.ui \
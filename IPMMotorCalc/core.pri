@@ -0,0 +1,46 @@
+# Model, log loading and tuning code shared by the GUI and the command line tools.
+# Must not depend on QtWidgets/QtCharts.
+
+QT += concurrent
+
+# The batched replay kernel uses SSE2 by default on x86, build with qmake CONFIG+=avx2 or CONFIG+=avx512 to use the
+# wider instruction sets. Neither option enables FMA (-mavx512f doesn't imply -mfma) so the kernel still matches the
+# scalar model bit for bit, adding -mfma or -march=native lets the compiler fuse multiply-adds and the errors then only
+# agree to within rounding (about 1e-15 relative).
+avx2 {
+    msvc: QMAKE_CXXFLAGS += /arch:AVX2
+    else: QMAKE_CXXFLAGS += -mavx2
+}
+avx512 {
+    msvc: QMAKE_CXXFLAGS += /arch:AVX512
+    else: QMAKE_CXXFLAGS += -mavx512f
+}
+
+# qmake CONFIG+=perfstats builds in the phase timers and counters (see perfstats.h), shown in the GUI status bar and
+# written out with --perf on the command line
+perfstats {
+    DEFINES += IPM_PERFSTATS
+}
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+SOURCES += \
+    $$PWD/motormodel.cpp \
+    $$PWD/logdata.cpp \
+    $$PWD/motortuner.cpp \
+    $$PWD/replaykernel.cpp \
+    $$PWD/rlsestimator.cpp \
+    $$PWD/errorindex.cpp \
+    $$PWD/loggenerator.cpp \
+    $$PWD/perfstats.cpp
+
+HEADERS += \
+    $$PWD/motormodel.h \
+    $$PWD/logdata.h \
+    $$PWD/motortuner.h \
+    $$PWD/replaykernel.h \
+    $$PWD/rlsestimator.h \
+    $$PWD/errorindex.h \
+    $$PWD/loggenerator.h \
+    $$PWD/perfstats.h
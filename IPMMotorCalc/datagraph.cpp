@@ -18,12 +18,15 @@
  */
 
 #include "datagraph.h"
+#include "perfstats.h"
 #include <QtCore/QRandomGenerator>
 #include <QtCore/QtMath>
 #include <QtCharts/QChart>
 #include <QtCharts/QChartView>
 #include <QSettings>
+#include <QtConcurrent>
 #include <limits>
+#include <algorithm>
 
 DataGraph::DataGraph(QString name, QWidget *parent) : QMainWindow(parent)
 {
@@ -36,6 +39,7 @@ DataGraph::DataGraph(QString name, QWidget *parent) : QMainWindow(parent)
     maxY_R =  std::numeric_limits<double>::lowest();
     minX =  std::numeric_limits<double>::max();
     maxX =  std::numeric_limits<double>::lowest();
+    m_stale = false;
 
     m_chart = new Chart();
     m_chart->legend()->show();
@@ -49,6 +53,8 @@ DataGraph::DataGraph(QString name, QWidget *parent) : QMainWindow(parent)
     m_chart->addAxis(m_axisX, Qt::AlignBottom);
     m_chart->addAxis(m_axisL, Qt::AlignLeft);
     m_chart->addAxis(m_axisR, Qt::AlignRight);
+    //zooming and scrolling all end up changing the x axis range so redraw at the new level of detail from here
+    connect(m_axisX, &QValueAxis::rangeChanged, this, &DataGraph::xRangeChanged);
 
     setCentralWidget(m_chartView);
     if(!restoreGeometry(settings.value(mName + "/geometry").toByteArray()) || !restoreState(settings.value(mName + "/windowState").toByteArray()))
@@ -82,6 +88,7 @@ void DataGraph::saveWinState()
 DataGraph::~DataGraph()
 {
     clearData();
+    qDeleteAll(m_series);
 }
 
 void DataGraph::addSeries(QString legend, axisSel axis, int key)
@@ -89,96 +96,206 @@ void DataGraph::addSeries(QString legend, axisSel axis, int key)
     if(m_series.contains(key))
         return;
 
-    QList<QPointF> *series = new QList<QPointF>;
+    graph_series *series = new graph_series;
+    series->legend = legend;
+    series->axis = axis;
+    series->view = series_view{&series->points, nullptr, chan_id};
+    series->scanned = 0;
+    series->line = nullptr;
     m_series[key] = series;
-    m_legends[key] = legend;
-    m_axis[key] = axis;
 }
 
 void DataGraph::updateSeries(QString legend, axisSel axis, int key)
 {
-    if(!m_series.contains(key))
+    graph_series *series = m_series.value(key);
+    if(!series)
         return;
 
-    m_legends[key] = legend;
-    m_axis[key] = axis;
+    if(series->line)
+    {
+        series->line->setName(legend);
+        if(axis != series->axis)
+        {
+            series->line->detachAxis(axis == axis_left ? m_axisR : m_axisL);
+            series->line->attachAxis(axis == axis_left ? m_axisL : m_axisR);
+        }
+    }
+    series->legend = legend;
+    series->axis = axis;
 }
 
-
+//the line series for a key is created the first time it is drawn and then kept, only its points get replaced
+QLineSeries *DataGraph::lineSeries(int key)
+{
+    graph_series *series = m_series.value(key);
+    if(series->line)
+        return series->line;
+
+    QLineSeries *line = new QLineSeries(); //chart will take ownership of this and delete when done
+    series->line = line;
+    m_chart->addSeries(line);
+    line->setName(series->legend);
+    if(m_colours.contains(key)) //if we have a colour then override standard one
+        line->setColor(m_colours[key]);
+    if(m_opacity.contains(key)) //if we have an opacity then override standard one
+        line->setOpacity(m_opacity[key]);
+    line->attachAxis(m_axisX);
+    if(series->axis == axis_left)
+        line->attachAxis(m_axisL);
+    else
+        line->attachAxis(m_axisR);
+    return line;
+}
 
 void DataGraph::addDataPoint(double x, double y, int key)
 {
-    if(m_series.contains(key))
-    {
-        if( m_axis[key] == axis_left)
-        {
-            if(y<minY_L) minY_L = y;
-            if(y>maxY_L) maxY_L = y;
-        }
-        else
-        {
-            if(y<minY_R) minY_R = y;
-            if(y>maxY_R) maxY_R = y;
-        }
-        if(x<minX) minX = x;
-        if(x>maxX) maxX = x;
+    graph_series *series = m_series.value(key);
+    if(series && !series->view.log)
+        series->points.append(QPointF(x, y));
+}
 
-        m_series[key]->append(QPointF(x, y));
+//for points that arrive out of x order (e.g. tuning candidates as they finish on the pool), keeps the series sorted so
+//it draws as a line and the pyramid can still be used
+void DataGraph::insertDataPoint(double x, double y, int key)
+{
+    graph_series *series = m_series.value(key);
+    if(!series || series->view.log)
+        return;
+
+    QVector<QPointF> &points = series->points;
+    int pos = std::upper_bound(points.begin(), points.end(), x, [](double val, const QPointF &p) {return val < p.x();}) - points.begin();
+    points.insert(pos, QPointF(x, y));
+    if(pos == (points.size() - 1))
+        return; //just an append
+
+    if(pos < series->scanned)
+    {   //the ranges only scan from the end so count it now
+        double &minY = series->axis == axis_left ? minY_L : minY_R;
+        double &maxY = series->axis == axis_left ? maxY_L : maxY_R;
+        minY = qMin(minY, y);
+        maxY = qMax(maxY, y);
+        minX = qMin(minX, x);
+        maxX = qMax(maxX, x);
+        series->scanned++;
     }
+    series->lod.clear(); //only ever extended at the end so start it again
 }
 
-void DataGraph::addDataPoints(QList<QPointF> pointList, int key)
+void DataGraph::addDataPoints(const QList<QPointF> &pointList, int key)
 {
-    if(m_series.contains(key))
+    graph_series *series = m_series.value(key);
+    if(series && !series->view.log)
     {
-        QListIterator<QPointF> i(pointList);
-        while (i.hasNext())
-        {
-            QPointF p = i.next();
-
-            if( m_axis[key] == axis_left)
-            {
-                if(p.y()<minY_L) minY_L = p.y();
-                if(p.y()>maxY_L) maxY_L = p.y();
-            }
-            else
-            {
-                if(p.y()<minY_R) minY_R = p.y();
-                if(p.y()>maxY_R) maxY_R = p.y();
-            }
-            if(p.x()<minX) minX = p.x();
-            if(p.x()>maxX) maxX = p.x();
-        }
+        series->points.reserve(series->points.size() + pointList.size());
+        for(const QPointF &p : pointList)
+            series->points.append(p);
+    }
+}
+
+//draw a channel of the log without copying it, the log must outlive the view or be cleared with clearData first
+void DataGraph::setLogView(const LogData *log, log_channel ch, int key)
+{
+    graph_series *series = m_series.value(key);
+    if(!series)
+        return;
+
+    series->points.clear();
+    series->points.squeeze();
+    series->view = series_view{nullptr, log, ch};
+    series->scanned = 0;
+}
 
-        m_series[key]->append(pointList);
+//the axis ranges follow whatever has been added since the last update
+void DataGraph::updateRanges(graph_series *series)
+{
+    const series_view &view = series->view;
+    int n = view.size();
+    double &minY = series->axis == axis_left ? minY_L : minY_R;
+    double &maxY = series->axis == axis_left ? maxY_L : maxY_R;
+    for(int i=series->scanned; i<n; i++)
+    {
+        double x = view.x(i);
+        double y = view.y(i);
+        if(y<minY) minY = y;
+        if(y>maxY) maxY = y;
+        if(x<minX) minX = x;
+        if(x>maxX) maxX = x;
     }
+    series->scanned = n;
 }
 
 void DataGraph::updateGraph(void)
 {
-    m_chart->removeAllSeries();
-
-    QMap<int, QList<QPointF> *>::iterator i;
+    PERF_SCOPE("graph.update");
+    QMap<int, graph_series *>::iterator i;
     for (i = m_series.begin(); i != m_series.end(); ++i)
     {
-        QLineSeries *series = new QLineSeries(); //chart will take ownership of this and delete when done
-        series->append(*i.value());
-        m_chart->addSeries(series);
-        series->setName(m_legends[i.key()]);
-        if(m_colours.contains(i.key())) //if we have a colour then override standard one
-            series->setColor(m_colours[i.key()]);
-        if(m_opacity.contains(i.key())) //if we have an opacity then override standard one
-            series->setOpacity(m_opacity[i.key()]);
-        series->attachAxis(m_axisX);
-        if(m_axis[i.key()] == axis_left)
-            series->attachAxis(m_axisL);
-        else
-            series->attachAxis(m_axisR);
+        lineSeries(i.key());
+        updateRanges(i.value());
     }
 
+    //a move of the x range redraws through xRangeChanged, otherwise nothing has redrawn yet so do it here
+    m_stale = true;
     m_axisX->setRange(minX, maxX);
     m_axisL->setRange(minY_L, maxY_L);
     m_axisR->setRange(minY_R, maxY_R);
+    if(m_stale)
+        refreshSeries();
+}
+
+//only hand the chart around two points per pixel of the visible range, the pyramid keeps the peaks. Bringing
+//the pyramids up to date and picking the points is done on the thread pool, just the replace() is left for here
+void DataGraph::refreshSeries(void)
+{
+    PERF_SCOPE("graph.refresh");
+    bool rebuild = m_stale;
+    m_stale = false;
+    QVector<graph_series *> drawn;
+    QMap<int, graph_series *>::iterator i;
+    for (i = m_series.begin(); i != m_series.end(); ++i)
+    {
+        if(i.value()->line)
+            drawn.append(i.value());
+    }
+    if(drawn.isEmpty())
+        return;
+
+    int pixels = qRound(m_chart->plotArea().width());
+    if(pixels <= 0)
+        pixels = width();
+    double xmin = m_axisX->min();
+    double xmax = m_axisX->max();
+
+    QVector<QVector<QPointF> > results(drawn.size());
+    QVector<QPointF> *out = results.data();
+    QVector<int> jobs(drawn.size());
+    for(int n=0; n<jobs.size(); n++)
+        jobs[n] = n;
+    QtConcurrent::blockingMap(jobs, [&drawn, out, rebuild, xmin, xmax, pixels](int n)
+    {
+        graph_series *series = drawn.at(n);
+        if(rebuild)
+            series->lod.build(series->view);
+        out[n] = series->lod.query(xmin, xmax, pixels);
+    });
+
+    for(int n=0; n<drawn.size(); n++)
+    {
+        drawn[n]->line->replace(results[n]);
+        PERF_COUNT("graph.points", results[n].size());
+    }
+}
+
+void DataGraph::xRangeChanged(qreal min, qreal max)
+{
+    refreshSeries();
+    emit windowChanged(min, max);
+}
+
+void DataGraph::resizeEvent(QResizeEvent *event)
+{
+    QMainWindow::resizeEvent(event);
+    refreshSeries();
 }
 
 void DataGraph::updateXaxis(double min, double max)
@@ -205,22 +322,31 @@ void DataGraph::clearData(void)
     maxY_R =  std::numeric_limits<double>::lowest();
     minX =  std::numeric_limits<double>::max();
     maxX =  std::numeric_limits<double>::lowest();
-    m_chart->removeAllSeries();
-    QMap<int, QList<QPointF> *>::iterator i;
+    QMap<int, graph_series *>::iterator i;
     for (i = m_series.begin(); i != m_series.end(); ++i)
     {
-        i.value()->clear();
+        graph_series *series = i.value();
+        series->points.clear();
+        series->view = series_view{&series->points, nullptr, chan_id};
+        series->scanned = 0;
+        series->lod.clear();
+        if(series->line)
+            series->line->clear();
     }
 }
 
 void DataGraph::setColour(QColor colour, int key)
 {
     m_colours[key] = colour;
+    if(m_series.contains(key) && m_series[key]->line)
+        m_series[key]->line->setColor(colour);
 }
 
 void DataGraph::setOpacity(qreal opacity, int key)
 {
     m_opacity[key] = opacity;
+    if(m_series.contains(key) && m_series[key]->line)
+        m_series[key]->line->setOpacity(opacity);
 }
 
 
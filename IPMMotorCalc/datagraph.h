@@ -25,9 +25,21 @@
 #include <QtCharts/QValueAxis>
 #include "chartview.h"
 #include "chart.h"
+#include "serieslod.h"
 
 enum axisSel {axis_left,axis_right};
 
+//everything the graph keeps for one key, points is only used when the view isn't onto a log
+struct graph_series {
+    QString legend;
+    axisSel axis;
+    QVector<QPointF> points;
+    series_view view;
+    int scanned; //points already counted in the axis ranges
+    SeriesLod lod;
+    QLineSeries *line; //persistent, owned by the chart
+};
+
 class DataGraph : public QMainWindow
 {
     Q_OBJECT
@@ -38,7 +50,9 @@ public:
     void addSeries(QString legend, axisSel axis, int key);
     void updateSeries(QString legend, axisSel axis, int key);
     void addDataPoint(double x, double y, int key);
-    void addDataPoints(QList<QPointF> pointList, int key);
+    void insertDataPoint(double x, double y, int key);
+    void addDataPoints(const QList<QPointF> &pointList, int key);
+    void setLogView(const LogData *log, log_channel ch, int key);
     void clearData();
     void updateGraph(void);
     void updateXaxis(double min, double max);
@@ -51,23 +65,32 @@ public:
 private:
     Chart *m_chart;
     ChartView *m_chartView;
-    QMap<int, QList<QPointF> *> m_series;
-    QMap<int, QString> m_legends;
+    QMap<int, graph_series *> m_series;
     QMap<int, QColor> m_colours;
     QMap<int, qreal> m_opacity;
-    QMap<int, axisSel> m_axis;
 
     double minX, maxX, minY_L, maxY_L, minY_R, maxY_R;
     QString mName;
+    bool m_stale; //data added since the pyramids were last built
 
     QValueAxis *m_axisL;
     QValueAxis *m_axisR;
     QValueAxis *m_axisX;
 
+    QLineSeries *lineSeries(int key);
+    void updateRanges(graph_series *series);
+    void refreshSeries(void);
+
+protected:
+    void resizeEvent(QResizeEvent *event) override;
 
 signals:
+    void windowChanged(double min, double max); //x axis zoomed or panned
 
 public slots:
+
+private slots:
+    void xRangeChanged(qreal min, qreal max);
 };
 
 #endif // DATAGRAPH_H
@@ -0,0 +1,164 @@
+/*
+ * This file is part of the IPMMotorCalc project
+ *
+ * Copyright (C) 2023 Pete9008 <openinverter.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "errorindex.h"
+#include "perfstats.h"
+#include <QtMath>
+#include <QtConcurrent>
+#include <cstring>
+
+void voltage_sums::add(double id, double iq, double ud, double uq, double frq)
+{
+    double w = 2 * M_PI * frq;
+    s[sum_dd] += id * id;
+    s[sum_qq] += iq * iq;
+    s[sum_wdq] += w * id * iq;
+    s[sum_wq] += w * iq;
+    s[sum_wwdd] += w * w * id * id;
+    s[sum_wwd] += w * w * id;
+    s[sum_wwqq] += w * w * iq * iq;
+    s[sum_ww] += w * w;
+    s[sum_dud] += id * ud;
+    s[sum_quq] += iq * uq;
+    s[sum_wduq] += w * id * uq;
+    s[sum_wqud] += w * iq * ud;
+    s[sum_wuq] += w * uq;
+    s[sum_udud] += ud * ud;
+    s[sum_uquq] += uq * uq;
+    rows++;
+}
+
+//sum of (Rs*Id - w*Lq*Iq - ud)^2 expanded
+double voltage_sums::errorVd(double Rs, double Lq) const
+{
+    double err = (Rs * Rs * s[sum_dd]) + (Lq * Lq * s[sum_wwqq]) + s[sum_udud]
+               - (2 * Rs * Lq * s[sum_wdq]) - (2 * Rs * s[sum_dud]) + (2 * Lq * s[sum_wqud]);
+    return qMax(0.0, err); //rounding can take a near perfect fit just below zero
+}
+
+//sum of (Rs*Iq + w*Ld*Id + w*λ - uq)^2 expanded
+double voltage_sums::errorVq(double Rs, double Ld, double fluxLink) const
+{
+    double err = (Rs * Rs * s[sum_qq]) + (Ld * Ld * s[sum_wwdd]) + (fluxLink * fluxLink * s[sum_ww]) + s[sum_uquq]
+               + (2 * Rs * Ld * s[sum_wdq]) + (2 * Rs * fluxLink * s[sum_wq]) + (2 * Ld * fluxLink * s[sum_wwd])
+               - (2 * Rs * s[sum_quq]) - (2 * Ld * s[sum_wduq]) - (2 * fluxLink * s[sum_wuq]);
+    return qMax(0.0, err);
+}
+
+//exact sum of a and b as hi + lo
+static inline void twoSum(double a, double b, double *hi, double *lo)
+{
+    double s = a + b;
+    double bb = s - a;
+    *lo = (a - (s - bb)) + (b - bb);
+    *hi = s;
+}
+
+void ErrorIndex::clear(void)
+{
+    m_data = nullptr;
+    m_rows.clear();
+    m_blocks.clear();
+}
+
+//Blocks are independent of each other so are summed in parallel, only the block totals are carried in order
+void ErrorIndex::build(const LogData *data)
+{
+    clear();
+    m_data = data;
+    update();
+}
+
+void ErrorIndex::update(void)
+{
+    PERF_SCOPE("index.update");
+    if(!m_data)
+        return;
+    int size = m_data->size();
+    int done = qMax(0, m_rows.size() - 1);
+    if(size <= done)
+        return;
+
+    int firstBlock = done / INDEX_BLOCK; //may be part built, it's redone
+    int blockCount = (size + INDEX_BLOCK - 1) / INDEX_BLOCK;
+    m_rows.resize(size + 1);
+    m_blocks.resize(blockCount);
+
+    QVector<int> blocks;
+    for(int b=firstBlock; b<blockCount; b++)
+        blocks.append(b);
+    QtConcurrent::blockingMap(blocks, [this](int block)
+    {
+        buildBlock(block);
+    });
+
+    if(firstBlock == 0)
+        memset(&m_blocks[0], 0, sizeof(block_sums));
+    for(int b=qMax(1, firstBlock); b<blockCount; b++)
+    {
+        const block_sums &prev = m_blocks[b - 1];
+        const row_sums &total = m_rows[b * INDEX_BLOCK]; //all of the previous block
+        for(int t=0; t<sum_count; t++)
+        {
+            double hi, lo;
+            twoSum(prev.hi[t], total.s[t], &hi, &lo);
+            twoSum(hi, lo + prev.lo[t], &m_blocks[b].hi[t], &m_blocks[b].lo[t]);
+        }
+    }
+}
+
+//m_rows[i + 1] for the rows i of one block, so m_rows at a block boundary holds the whole of the block before it
+void ErrorIndex::buildBlock(int block)
+{
+    const double *id = m_data->channel(chan_id);
+    const double *iq = m_data->channel(chan_iq);
+    const double *ud = m_data->channel(chan_ud);
+    const double *uq = m_data->channel(chan_uq);
+    const double *frq = m_data->channel(chan_frq);
+
+    int first = block * INDEX_BLOCK;
+    int last = qMin(first + INDEX_BLOCK, m_rows.size() - 1);
+    voltage_sums acc;
+    memset(&acc, 0, sizeof(acc));
+    for(int i=first; i<last; i++)
+    {
+        acc.add(id[i], iq[i], ud[i], uq[i], frq[i]);
+        memcpy(m_rows[i + 1].s, acc.s, sizeof(acc.s));
+    }
+    if(block == 0)
+        memset(m_rows[0].s, 0, sizeof(m_rows[0].s));
+}
+
+bool ErrorIndex::covers(const LogData *data, const log_window &window) const
+{   //in a sorted log every row between begin and end is inside the window
+    return data && (data == m_data) && data->isSorted() && (window.end < m_rows.size());
+}
+
+voltage_sums ErrorIndex::sums(int begin, int end) const
+{
+    voltage_sums result;
+    int blockEnd = end ? (end - 1) / INDEX_BLOCK : 0;
+    int blockBegin = begin ? (begin - 1) / INDEX_BLOCK : 0;
+    const block_sums &be = m_blocks[blockEnd];
+    const block_sums &bb = m_blocks[blockBegin];
+    for(int t=0; t<sum_count; t++)
+        result.s[t] = ((be.hi[t] - bb.hi[t]) + (be.lo[t] - bb.lo[t])) + (m_rows[end].s[t] - m_rows[begin].s[t]);
+    result.rows = end - begin;
+    return result;
+}
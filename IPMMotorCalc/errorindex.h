@@ -0,0 +1,69 @@
+/*
+ * This file is part of the IPMMotorCalc project
+ *
+ * Copyright (C) 2023 Pete9008 <openinverter.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ERRORINDEX_H
+#define ERRORINDEX_H
+
+#include <QVector>
+#include "logdata.h"
+
+#define INDEX_BLOCK 1024 //rows summed locally before the running total is carried in double-double
+
+//The distinct products behind the steady state voltage equations used by MotorModel::Step
+//  Vd = Rs*Id - w*Lq*Iq
+//  Vq = Rs*Iq + w*Ld*Id + w*λ
+//summed over some rows. Enough to give the squared error of either equation for any Rs, Ld, Lq, λ without going back
+//to the rows.
+enum sum_term {sum_dd, sum_qq, sum_wdq, sum_wq, sum_wwdd, sum_wwd, sum_wwqq, sum_ww,
+               sum_dud, sum_quq, sum_wduq, sum_wqud, sum_wuq, sum_udud, sum_uquq, sum_count};
+
+struct voltage_sums {
+    double s[sum_count];
+    int rows;
+
+    void add(double id, double iq, double ud, double uq, double frq);
+    double errorVd(double Rs, double Lq) const; //sum of squared Vd errors
+    double errorVq(double Rs, double Ld, double fluxLink) const; //sum of squared Vq errors
+};
+
+//Prefix sums of voltage_sums over a log, so the sums for any rows [begin, end) cost two lookups whatever the window.
+//Each row holds the sum from the start of its INDEX_BLOCK, each block the total before it as a double-double, which
+//keeps a short window at the end of a long log as accurate as one at the start. Costs around 120 bytes per log row.
+class ErrorIndex
+{
+public:
+    ErrorIndex() : m_data{nullptr} {}
+    void build(const LogData *data);
+    void update(void); //picks up rows appended to the log since build/update
+    void clear(void);
+    bool covers(const LogData *data, const log_window &window) const;
+    voltage_sums sums(int begin, int end) const;
+
+private:
+    struct row_sums {double s[sum_count];};
+    struct block_sums {double hi[sum_count]; double lo[sum_count];};
+
+    void buildBlock(int block);
+
+    const LogData *m_data;
+    QVector<row_sums> m_rows; //one more than the log, m_rows[i] is the sum of the block's rows before i
+    QVector<block_sums> m_blocks; //sum of all rows before the block
+};
+
+#endif // ERRORINDEX_H
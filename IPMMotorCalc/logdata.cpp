@@ -0,0 +1,504 @@
+/*
+ * This file is part of the IPMMotorCalc project
+ *
+ * Copyright (C) 2023 Pete9008 <openinverter.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logdata.h"
+#include "perfstats.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDateTime>
+#include <QStringList>
+#include <QThread>
+#include <QtConcurrent>
+#include <QtMath>
+#include <cstring>
+#include <algorithm>
+
+#define MIN_CHUNK_SIZE (1024*1024)
+#define CACHE_VERSION 2
+#define CACHE_HASH_SPAN (64*1024)
+
+//Sidecar cache written next to the log after it has been parsed, identifies the source by size, modification time
+//and a hash of its first and last 64kB. rowSize and byteOrder catch caches written by a build with a different layout.
+//The header is followed by the time column then each of the chan_count channels in log_channel order.
+struct cache_header {
+    char magic[8];
+    quint32 version;
+    quint32 byteOrder;
+    quint32 rowSize;
+    quint32 reserved;
+    qint64 sourceSize;
+    qint64 sourceModified; //ms since epoch
+    quint64 sourceHash;
+    qint64 startTime;
+    qint64 rows;
+};
+
+static const double powersOf10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+//Decimal number parser for the numeric columns, [-+]digits[.digits][e[-+]digits]. Up to 19 significant digits are
+//accumulated as an integer and scaled by an exact power of ten so typical log values round the same as toDouble().
+//Like QString::toDouble() anything that isn't a number gives 0.
+static double parseDouble(const char *p, const char *end)
+{
+    bool neg = false;
+    while((p < end) && (*p == ' '))
+        p++;
+    if((p < end) && ((*p == '-') || (*p == '+')))
+        neg = (*p++ == '-');
+
+    quint64 mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any = false;
+    for(; (p < end) && (*p >= '0') && (*p <= '9'); p++)
+    {
+        any = true;
+        if(digits < 19)
+        {
+            mantissa = (mantissa * 10) + (*p - '0');
+            if(mantissa) digits++;
+        }
+        else
+            exponent++;
+    }
+    if((p < end) && (*p == '.'))
+    {
+        for(p++; (p < end) && (*p >= '0') && (*p <= '9'); p++)
+        {
+            any = true;
+            if(digits < 19)
+            {
+                mantissa = (mantissa * 10) + (*p - '0');
+                if(mantissa) digits++;
+                exponent--;
+            }
+        }
+    }
+    if(!any)
+        return 0;
+    if((p < end) && ((*p == 'e') || (*p == 'E')))
+    {
+        bool expNeg = false;
+        int exp = 0;
+        p++;
+        if((p < end) && ((*p == '-') || (*p == '+')))
+            expNeg = (*p++ == '-');
+        for(; (p < end) && (*p >= '0') && (*p <= '9'); p++)
+            if(exp < 10000) exp = (exp * 10) + (*p - '0');
+        exponent += expNeg ? -exp : exp;
+    }
+
+    double val = (double)mantissa;
+    if((exponent < 0) && (exponent >= -22))
+        val /= powersOf10[-exponent];
+    else if((exponent > 0) && (exponent <= 22))
+        val *= powersOf10[exponent];
+    else if(exponent != 0)
+        val *= qPow(10.0, exponent);
+    return neg ? -val : val;
+}
+
+static int parseDigits(const char *p, int n)
+{
+    int val = 0;
+    for(int i=0; i<n; i++)
+        val = (val * 10) + (p[i] - '0');
+    return val;
+}
+
+//Fixed format yyyy-MM-ddTHH:mm:ss.zzz, returns ms since epoch treating the time as UTC. Only differences between
+//rows are used so the time zone doesn't matter (and a DST change part way through a log no longer adds an hour).
+static bool parseTimestamp(const char *p, const char *end, qint64 *ms)
+{
+    if(((end - p) < 23) || (p[4] != '-') || (p[7] != '-') || (p[10] != 'T') || (p[13] != ':') || (p[16] != ':') || (p[19] != '.'))
+        return false;
+    static const int digitPos[] = {0, 1, 2, 3, 5, 6, 8, 9, 11, 12, 14, 15, 17, 18, 20, 21, 22};
+    for(unsigned i=0; i<(sizeof(digitPos)/sizeof(digitPos[0])); i++)
+        if((p[digitPos[i]] < '0') || (p[digitPos[i]] > '9'))
+            return false;
+
+    int y = parseDigits(p, 4);
+    int m = parseDigits(p + 5, 2);
+    int d = parseDigits(p + 8, 2);
+    //days from civil, H. Hinnant
+    y -= (m <= 2);
+    qint64 era = (y >= 0 ? y : y - 399) / 400;
+    qint64 yoe = y - (era * 400);
+    qint64 doy = (((153 * (m + (m > 2 ? -3 : 9))) + 2) / 5) + d - 1;
+    qint64 doe = (yoe * 365) + (yoe / 4) - (yoe / 100) + doy;
+    qint64 days = (era * 146097) + doe - 719468;
+
+    qint64 secs = (days * 86400) + (parseDigits(p + 11, 2) * 3600) + (parseDigits(p + 14, 2) * 60) + parseDigits(p + 17, 2);
+    *ms = (secs * 1000) + parseDigits(p + 20, 3);
+    return true;
+}
+
+bool LogData::parseHeader(QString line, log_columns *cols)
+{
+    QStringList fieldList = line.trimmed().split(u',');
+    cols->time = fieldList.indexOf("Timestamp");
+    cols->udc = fieldList.indexOf("udc");
+    cols->id = fieldList.indexOf("id");
+    cols->iq = fieldList.indexOf("iq");
+    cols->ud = fieldList.indexOf("ud");
+    cols->uq = fieldList.indexOf("uq");
+    cols->frq = fieldList.indexOf("fstat");
+    cols->minFields = qMax(qMax(qMax(cols->time, cols->udc), qMax(cols->id, cols->iq)), qMax(qMax(cols->ud, cols->uq), cols->frq)) + 1;
+    return (cols->time>=0) && (cols->udc>=0) && (cols->id>=0) && (cols->iq>=0) && (cols->ud>=0) && (cols->uq>=0) && (cols->frq>=0);
+}
+
+//Parses every complete line in [begin, end), times are left as ms since epoch
+void LogData::parseRows(const char *begin, const char *end, const log_columns &cols, LogData *rows)
+{
+    //Only the seven columns used are kept, so logs can have any number of columns. slot[] maps a field index to
+    //where that field is stored, -1 for the columns skipped over.
+    enum { f_time, f_udc, f_id, f_iq, f_ud, f_uq, f_frq, f_count };
+    const char *fields[f_count];
+    const char *fieldEnds[f_count];
+    QVector<int> slot(cols.minFields, -1);
+    slot[cols.time] = f_time;
+    slot[cols.udc] = f_udc;
+    slot[cols.id] = f_id;
+    slot[cols.iq] = f_iq;
+    slot[cols.ud] = f_ud;
+    slot[cols.uq] = f_uq;
+    slot[cols.frq] = f_frq;
+
+    const char *p = begin;
+    while(p < end)
+    {
+        const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+        if(!eol)
+            eol = end;
+
+        int count = 0;
+        const char *f = p;
+        while(count < cols.minFields)
+        {
+            const char *comma = static_cast<const char *>(memchr(f, ',', eol - f));
+            if(slot[count] >= 0)
+            {
+                fields[slot[count]] = f;
+                fieldEnds[slot[count]] = comma ? comma : eol;
+            }
+            count++;
+            if(!comma)
+                break;
+            f = comma + 1;
+        }
+
+        qint64 stamp;
+        if((count >= cols.minFields) && parseTimestamp(fields[f_time], fieldEnds[f_time], &stamp))
+        {
+            file_data ipline;
+            ipline.time = stamp;
+            double voltageDiv2 = parseDouble(fields[f_udc], fieldEnds[f_udc])/2.0;
+            ipline.id = parseDouble(fields[f_id], fieldEnds[f_id]);
+            ipline.iq = parseDouble(fields[f_iq], fieldEnds[f_iq]);
+            ipline.ud = (voltageDiv2/32768)*parseDouble(fields[f_ud], fieldEnds[f_ud]);
+            ipline.uq = (voltageDiv2/32768)*parseDouble(fields[f_uq], fieldEnds[f_uq]);
+            ipline.frq = parseDouble(fields[f_frq], fieldEnds[f_frq]);
+            rows->append(ipline);
+        }
+        p = eol + 1;
+    }
+}
+
+void LogData::clear(void)
+{
+    m_time.clear();
+    for(int ch=0; ch<chan_count; ch++)
+        m_channels[ch].clear();
+    m_startTime = 0;
+    m_sorted = true;
+}
+
+void LogData::reserve(int rows)
+{
+    m_time.reserve(rows);
+    for(int ch=0; ch<chan_count; ch++)
+        m_channels[ch].reserve(rows);
+}
+
+file_data LogData::row(int i) const
+{
+    file_data r;
+    r.time = m_time[i];
+    r.id = m_channels[chan_id][i];
+    r.iq = m_channels[chan_iq][i];
+    r.ud = m_channels[chan_ud][i];
+    r.uq = m_channels[chan_uq][i];
+    r.frq = m_channels[chan_frq][i];
+    return r;
+}
+
+void LogData::append(const file_data &row)
+{
+    if(!m_time.isEmpty() && (row.time < m_time.last()))
+        m_sorted = false;
+    m_time.append(row.time);
+    m_channels[chan_id].append(row.id);
+    m_channels[chan_iq].append(row.iq);
+    m_channels[chan_ud].append(row.ud);
+    m_channels[chan_uq].append(row.uq);
+    m_channels[chan_frq].append(row.frq);
+}
+
+void LogData::append(const LogData &other)
+{
+    if(!other.m_sorted || (!m_time.isEmpty() && !other.m_time.isEmpty() && (other.m_time.first() < m_time.last())))
+        m_sorted = false;
+    m_time += other.m_time;
+    for(int ch=0; ch<chan_count; ch++)
+        m_channels[ch] += other.m_channels[ch];
+}
+
+//Adds the complete lines in [begin, end) to the end of the log, for a log that is still being written. Times are made
+//relative to the first row ever added, same as loadCsv. Returns the number of rows added.
+int LogData::appendLines(const char *begin, const char *end, const log_columns &cols)
+{
+    PERF_SCOPE("log.append");
+    LogData rows;
+    parseRows(begin, end, cols, &rows);
+    if(rows.size() == 0)
+        return 0;
+
+    if(size() == 0)
+        m_startTime = rows.m_time[0];
+    for(int i=0; i<rows.m_time.size(); i++)
+        rows.m_time[i] -= m_startTime;
+    append(rows);
+    return rows.size();
+}
+
+//Resolves a time window (ms) to the rows the replay loops need to visit. Every loop compares row i with row i+1 so the
+//last row is never included. Logs are normally in time order so this is a binary search, if not the whole log is
+//returned and the loops fall back to testing every row.
+log_window LogData::window(double tmin, double tmax) const
+{
+    PERF_SCOPE("log.window");
+    log_window w;
+    w.tmin = tmin;
+    w.tmax = tmax;
+    w.begin = 0;
+    w.end = qMax(0, size() - 1);
+    if(m_sorted)
+    {
+        w.begin = std::lower_bound(m_time.constBegin(), m_time.constEnd(), tmin) - m_time.constBegin();
+        w.end = qMin(w.end, (int)(std::upper_bound(m_time.constBegin(), m_time.constEnd(), tmax) - m_time.constBegin()));
+        w.begin = qMin(w.begin, w.end);
+    }
+    return w;
+}
+
+//FNV-1a of the start and end of the file, cheap enough to do on every open
+static bool hashSource(QFile &file, quint64 *hash)
+{
+    quint64 h = 14695981039346656037ULL;
+    qint64 size = file.size();
+    qint64 offsets[2] = {0, qMax((qint64)0, size - CACHE_HASH_SPAN)};
+    for(int i=0; i<2; i++)
+    {
+        if(!file.seek(offsets[i]))
+            return false;
+        QByteArray block = file.read(CACHE_HASH_SPAN);
+        for(int j=0; j<block.size(); j++)
+        {
+            h ^= (quint8)block[j];
+            h *= 1099511628211ULL;
+        }
+    }
+    *hash = h;
+    return true;
+}
+
+static bool fillHeader(QString fileName, cache_header *header)
+{
+    QFile source(fileName);
+    if(!source.open(QIODevice::ReadOnly))
+        return false;
+    memset(header, 0, sizeof(cache_header));
+    memcpy(header->magic, "IPMCACHE", 8);
+    header->version = CACHE_VERSION;
+    header->byteOrder = 0x01020304;
+    header->rowSize = sizeof(qint64) + (chan_count * sizeof(double));
+    header->sourceSize = source.size();
+    header->sourceModified = QFileInfo(fileName).lastModified().toMSecsSinceEpoch();
+    return hashSource(source, &header->sourceHash);
+}
+
+bool LogData::loadCache(QString fileName)
+{
+    PERF_SCOPE("log.cacheRead");
+    cache_header expected;
+    if(!fillHeader(fileName, &expected))
+        return false;
+
+    QFile cache(cacheFileName(fileName));
+    if(!cache.open(QIODevice::ReadOnly) || (cache.size() < (qint64)sizeof(cache_header)))
+        return false;
+    const uchar *mem = cache.map(0, cache.size());
+    if(!mem)
+        return false;
+
+    cache_header header;
+    memcpy(&header, mem, sizeof(cache_header));
+    if((memcmp(header.magic, expected.magic, 8) != 0) || (header.version != expected.version) || (header.byteOrder != expected.byteOrder) ||
+       (header.rowSize != expected.rowSize) || (header.sourceSize != expected.sourceSize) ||
+       (header.sourceModified != expected.sourceModified) || (header.sourceHash != expected.sourceHash) ||
+       (header.rows < 0) || (cache.size() != (qint64)(sizeof(cache_header) + (header.rows * header.rowSize))))
+        return false;
+
+    const uchar *p = mem + sizeof(cache_header);
+    m_time.resize(header.rows);
+    memcpy(m_time.data(), p, header.rows * sizeof(qint64));
+    p += header.rows * sizeof(qint64);
+    for(int ch=0; ch<chan_count; ch++)
+    {
+        m_channels[ch].resize(header.rows);
+        memcpy(m_channels[ch].data(), p, header.rows * sizeof(double));
+        p += header.rows * sizeof(double);
+    }
+    m_startTime = header.startTime;
+    for(int i=1; i<m_time.size(); i++)
+    {
+        if(m_time[i] < m_time[i-1])
+        {
+            m_sorted = false;
+            break;
+        }
+    }
+    return true;
+}
+
+//best effort, a read only log directory just means no cache
+void LogData::saveCache(QString fileName)
+{
+    PERF_SCOPE("log.cacheWrite");
+    cache_header header;
+    if(!fillHeader(fileName, &header))
+        return;
+    header.startTime = m_startTime;
+    header.rows = size();
+
+    QSaveFile cache(cacheFileName(fileName));
+    if(!cache.open(QIODevice::WriteOnly))
+        return;
+    cache.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    cache.write(reinterpret_cast<const char *>(m_time.constData()), m_time.size() * sizeof(qint64));
+    for(int ch=0; ch<chan_count; ch++)
+        cache.write(reinterpret_cast<const char *>(m_channels[ch].constData()), m_channels[ch].size() * sizeof(double));
+    cache.commit();
+}
+
+struct parse_chunk {
+    const char *begin;
+    const char *end;
+    LogData rows;
+};
+
+//returns false if the file can't be opened or doesn't contain the minimum set of columns (Timestamp,udc,id,iq,ud,uq,fstat)
+//The file is memory mapped and split into newline aligned chunks which are parsed in parallel, the result is then
+//saved to a sidecar cache which is used instead next time if the log hasn't changed
+bool LogData::loadCsv(QString fileName, bool useCache)
+{
+    PERF_SCOPE("log.load");
+    clear();
+    if(useCache && loadCache(fileName))
+        return true;
+    clear();
+
+    QFile inFile(fileName);
+    if(!inFile.open(QIODevice::ReadOnly))
+        return false;
+
+    QByteArray buffer;
+    const char *data = reinterpret_cast<const char *>(inFile.size() ? inFile.map(0, inFile.size()) : nullptr);
+    qint64 length = inFile.size();
+    if(!data)
+    {   //can't map (e.g. not a regular file) so fall back to reading it in
+        buffer = inFile.readAll();
+        data = buffer.constData();
+        length = buffer.size();
+    }
+    const char *end = data + length;
+    const char *p = data;
+    if((length >= 3) && (memcmp(p, "\xEF\xBB\xBF", 3) == 0))
+        p += 3; //UTF-8 BOM
+
+    const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+    if(!eol)
+        eol = end;
+    log_columns cols;
+    if(!parseHeader(QString::fromUtf8(p, eol - p), &cols))
+    {
+        inFile.close();
+        return false;
+    }
+    p = (eol < end) ? eol + 1 : end;
+
+    int numChunks = qBound(1, (int)((end - p) / MIN_CHUNK_SIZE), QThread::idealThreadCount());
+    QVector<parse_chunk> chunks(numChunks);
+    qint64 chunkSize = (end - p) / numChunks;
+    for(int i=0; i<numChunks; i++)
+    {
+        chunks[i].begin = p;
+        if(i == numChunks-1)
+            p = end;
+        else
+        {
+            p += chunkSize;
+            const char *nl = static_cast<const char *>(memchr(p, '\n', end - p));
+            p = nl ? nl + 1 : end;
+        }
+        chunks[i].end = p;
+    }
+
+    {
+        PERF_SCOPE("log.parse");
+        QtConcurrent::blockingMap(chunks, [&cols](parse_chunk &chunk)
+        {
+            chunk.rows.reserve((chunk.end - chunk.begin) / 64);
+            parseRows(chunk.begin, chunk.end, cols, &chunk.rows);
+        });
+    }
+
+    int total = 0;
+    for(int i=0; i<numChunks; i++)
+        total += chunks[i].rows.size();
+    reserve(total);
+    for(int i=0; i<numChunks; i++)
+    {
+        append(chunks[i].rows);
+        chunks[i].rows.clear(); //release as we go to keep the peak down
+    }
+
+    if(size())
+        m_startTime = m_time[0];
+    for(int i=0; i<m_time.size(); i++)
+        m_time[i] -= m_startTime;
+    PERF_COUNT("log.rows", size());
+
+    inFile.close();
+    if(useCache)
+        saveCache(fileName);
+    return true;
+}
@@ -0,0 +1,89 @@
+/*
+ * This file is part of the IPMMotorCalc project
+ *
+ * Copyright (C) 2023 Pete9008 <openinverter.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOGDATA_H
+#define LOGDATA_H
+
+#include <QString>
+#include <QVector>
+
+//one row of the log, the log itself is stored by column (see LogData)
+struct file_data {
+    qint64 time; //ms from start of log
+    double id;
+    double iq;
+    double ud;
+    double uq;
+    double frq;
+};
+
+//column positions of the fields we need in an OpenInverter CSV
+struct log_columns {
+    int time, udc, id, iq, ud, uq, frq;
+    int minFields; //rows with fewer fields than this are skipped
+};
+
+//rows [begin, end) that can be inside the time window, the time test is still needed if the log isn't in time order
+struct log_window {
+    double tmin; //ms
+    double tmax; //ms
+    int begin;
+    int end;
+    bool contains(qint64 t) const {return (t >= tmin) && (t <= tmax);}
+};
+
+enum log_channel {chan_id, chan_iq, chan_ud, chan_uq, chan_frq, chan_count};
+
+//Parsed OpenInverter web log, independent of any of the GUI classes so it can be used by the command line tools too.
+//Stored as one contiguous array per channel so loops that only need a couple of channels don't pull the rest through
+//the cache. Time is in ms from the start of the log, ud/uq already scaled to volts.
+class LogData
+{
+public:
+    LogData() : m_startTime{0}, m_sorted{true} {}
+    bool loadCsv(QString fileName, bool useCache = true);
+    void clear(void);
+    void reserve(int rows);
+    int size(void) const {return m_time.size();}
+    const qint64 *times(void) const {return m_time.constData();}
+    const double *channel(log_channel ch) const {return m_channels[ch].constData();}
+    qint64 time(int i) const {return m_time[i];}
+    double value(log_channel ch, int i) const {return m_channels[ch][i];}
+    file_data row(int i) const;
+    bool isSorted(void) const {return m_sorted;}
+    log_window window(double tmin, double tmax) const;
+    void append(const file_data &row);
+    void append(const LogData &other);
+    int appendLines(const char *begin, const char *end, const log_columns &cols);
+
+    static bool parseHeader(QString line, log_columns *cols);
+    static void parseRows(const char *begin, const char *end, const log_columns &cols, LogData *rows);
+    static QString cacheFileName(QString fileName) {return fileName + ".ipmcache";}
+
+private:
+    bool loadCache(QString fileName);
+    void saveCache(QString fileName);
+
+    QVector<qint64> m_time;
+    QVector<double> m_channels[chan_count];
+    qint64 m_startTime; //ms since epoch of the first row
+    bool m_sorted; //time never goes backwards, so windows can be found by binary search
+};
+
+#endif // LOGDATA_H
@@ -0,0 +1,143 @@
+/*
+ * This file is part of the IPMMotorCalc project
+ *
+ * Copyright (C) 2023 Pete9008 <openinverter.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "loggenerator.h"
+#include <QDate>
+#include <QStringList>
+#include <random>
+#include <cstdio>
+
+#define GEN_BUFFER (1 << 20) //bytes formatted before each write
+
+double current_profile::value(double t) const
+{
+    double phase = (period > 0) ? (t / period) - qFloor(t / period) : 0; //0..1 through the cycle
+    switch(shape)
+    {
+    case profile_sine:
+        return offset + (amplitude * qSin(2 * M_PI * phase));
+    case profile_square:
+        return offset + ((phase < 0.5) ? amplitude : -amplitude);
+    case profile_triangle:
+        return offset + (amplitude * ((phase < 0.5) ? ((4 * phase) - 1) : (3 - (4 * phase))));
+    case profile_constant:
+    default:
+        return offset;
+    }
+}
+
+//Spins the motor over a range of speeds with both currents moving at unrelated rates, enough for all four parameters
+//to be fitted
+generator_options LogGenerator::defaultOptions(void)
+{
+    generator_options options;
+    options.rows = 100000;
+    options.intervalMs = 10;
+    options.udc = 400;
+    options.startFrq = 100;
+    options.voltageNoise = 0;
+    options.currentNoise = 0;
+    options.id = {profile_sine, -50, 40, 6.3};
+    options.iq = {profile_sine, 0, 100, 4.7};
+    options.seed = 1;
+    return options;
+}
+
+bool LogGenerator::parseProfile(QString text, current_profile *profile)
+{
+    QStringList parts = text.toLower().split(u':');
+    QStringList values = (parts.size() > 1) ? parts[1].split(u',') : QStringList();
+    if(parts[0] == "constant") profile->shape = profile_constant;
+    else if(parts[0] == "sine") profile->shape = profile_sine;
+    else if(parts[0] == "square") profile->shape = profile_square;
+    else if(parts[0] == "triangle") profile->shape = profile_triangle;
+    else return false;
+
+    double *fields[] = {&profile->offset, &profile->amplitude, &profile->period};
+    profile->amplitude = 0;
+    profile->period = 0;
+    if(values.isEmpty() || (values.size() > 3))
+        return false;
+    for(int i=0; i<values.size(); i++)
+    {
+        bool ok;
+        *fields[i] = values[i].toDouble(&ok);
+        if(!ok)
+            return false;
+    }
+    return (profile->shape == profile_constant) || (profile->period > 0);
+}
+
+//Each row steps the model through the interval with the profile currents, then logs the currents, the voltages of the
+//last step and the electrical frequency that step ran at, which is what MotorTuner::replay compares against. Raw
+//ud/uq are scaled by 32768/(udc/2) the way the inverter logs them.
+bool LogGenerator::write(QIODevice *device, MotorModel &motor, const generator_options &options)
+{
+    std::mt19937 rng(options.seed);
+    std::normal_distribution<double> noise(0, 1);
+    const double voltsToRaw = 32768/(options.udc/2);
+    const int steps = qMax(1, qRound(options.intervalMs / (motor.getTimestep() * 1000)));
+
+    motor.Restart();
+    motor.setSpeedFromElecFreq(options.startFrq);
+
+    QByteArray buffer;
+    buffer.reserve(GEN_BUFFER + 256);
+    buffer.append("Timestamp,udc,id,iq,ud,uq,fstat\n");
+
+    QByteArray date;
+    qint64 lastDay = -1;
+    char line[256];
+    for(qint64 row=0; row<options.rows; row++)
+    {
+        qint64 ms = row * options.intervalMs;
+        double t = ms / 1000.0;
+        double id = options.id.value(t);
+        double iq = options.iq.value(t);
+        double frq = 0;
+        for(int step=0; step<steps; step++)
+        {
+            frq = motor.getElecFreq(); //frequency the step's voltages are worked out at
+            motor.Step(iq, id);
+        }
+
+        qint64 day = ms / 86400000;
+        if(day != lastDay)
+        {
+            date = QDate(2023, 1, 1).addDays(day).toString("yyyy-MM-dd").toLatin1();
+            lastDay = day;
+        }
+        int msOfDay = ms % 86400000;
+        double vd = motor.getVd() + (options.voltageNoise * noise(rng));
+        double vq = motor.getVq() + (options.voltageNoise * noise(rng));
+        double loggedId = id + (options.currentNoise * noise(rng));
+        double loggedIq = iq + (options.currentNoise * noise(rng));
+        int len = std::snprintf(line, sizeof(line), "%sT%02d:%02d:%02d.%03d,%g,%.2f,%.2f,%.1f,%.1f,%.3f\n", date.constData(),
+                           msOfDay / 3600000, (msOfDay / 60000) % 60, (msOfDay / 1000) % 60, msOfDay % 1000,
+                           options.udc, loggedId, loggedIq, vd * voltsToRaw, vq * voltsToRaw, frq);
+        buffer.append(line, len);
+        if(buffer.size() >= GEN_BUFFER)
+        {
+            if(device->write(buffer) != buffer.size())
+                return false;
+            buffer.clear();
+        }
+    }
+    return device->write(buffer) == buffer.size();
+}
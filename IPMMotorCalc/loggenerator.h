@@ -0,0 +1,61 @@
+/*
+ * This file is part of the IPMMotorCalc project
+ *
+ * Copyright (C) 2023 Pete9008 <openinverter.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOGGENERATOR_H
+#define LOGGENERATOR_H
+
+#include <QString>
+#include <QIODevice>
+#include "motormodel.h"
+
+enum profile_shape {profile_constant, profile_sine, profile_square, profile_triangle};
+
+//A commanded current against time
+struct current_profile {
+    profile_shape shape;
+    double offset; //A
+    double amplitude; //A, peak
+    double period; //s
+
+    double value(double t) const;
+};
+
+struct generator_options {
+    qint64 rows;
+    int intervalMs; //between rows, the model is stepped at its timestep (1ms) in between
+    double udc; //V, only scales the logged ud/uq
+    double startFrq; //electrical Hz at the first row, the vehicle model takes it from there
+    double voltageNoise; //V rms added to the logged ud/uq
+    double currentNoise; //A rms added to the logged id/iq
+    current_profile id, iq;
+    quint32 seed; //same seed, same log
+};
+
+//Writes a log in the web logger's CSV format (Timestamp,udc,id,iq,ud,uq,fstat) from the motor model driven by the
+//current profiles, so the true parameters of the log are known. Rows are formatted into a small buffer and written as
+//they are made, memory use doesn't depend on the number of rows.
+class LogGenerator
+{
+public:
+    static generator_options defaultOptions(void);
+    static bool parseProfile(QString text, current_profile *profile); //shape:offset,amplitude,period e.g. sine:-50,40,6
+    static bool write(QIODevice *device, MotorModel &motor, const generator_options &options);
+};
+
+#endif // LOGGENERATOR_H
@@ -0,0 +1,165 @@
+/*
+ * This file is part of the IPMMotorCalc project
+ *
+ * Copyright (C) 2023 Pete9008 <openinverter.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logstream.h"
+#include <QTcpSocket>
+#include <QLocalSocket>
+#include <QUrl>
+
+#define STREAM_POLL_MS 50
+#define STREAM_MAX_BATCH (4*1024*1024) //bytes parsed per tick, ~50k rows of a typical log
+
+LogStream::LogStream(LogData *data, QObject *parent)
+    : QObject(parent), m_data{data}, m_device{nullptr}, m_haveHeader{false}
+{
+    m_timer.setInterval(STREAM_POLL_MS);
+    connect(&m_timer, &QTimer::timeout, this, &LogStream::poll);
+}
+
+LogStream::~LogStream()
+{
+    stop();
+}
+
+bool LogStream::start(QString source)
+{
+    stop();
+    m_pending.clear();
+    m_haveHeader = false;
+
+    //sockets connect in the background, polling starts once they are up and failed() is emitted if they can't be.
+    //Errors are queued as a local socket can report one from inside connectToServer, before start() has returned.
+    if(source.startsWith("tcp://"))
+    {
+        QUrl url(source);
+        QTcpSocket *socket = new QTcpSocket(this);
+        connect(socket, &QTcpSocket::connected, this, &LogStream::connected);
+#if QT_VERSION < QT_VERSION_CHECK(5, 15, 0)
+        connect(socket, QOverload<QAbstractSocket::SocketError>::of(&QAbstractSocket::error), this, &LogStream::connectFailed, Qt::QueuedConnection);
+#else
+        connect(socket, &QAbstractSocket::errorOccurred, this, &LogStream::connectFailed, Qt::QueuedConnection);
+#endif
+        m_device = socket;
+        socket->connectToHost(url.host(), url.port());
+        return true;
+    }
+    else if(source.startsWith("unix:"))
+    {
+        QLocalSocket *socket = new QLocalSocket(this);
+        connect(socket, &QLocalSocket::connected, this, &LogStream::connected);
+#if QT_VERSION < QT_VERSION_CHECK(5, 15, 0)
+        connect(socket, QOverload<QLocalSocket::LocalSocketError>::of(&QLocalSocket::error), this, &LogStream::connectFailed, Qt::QueuedConnection);
+#else
+        connect(socket, &QLocalSocket::errorOccurred, this, &LogStream::connectFailed, Qt::QueuedConnection);
+#endif
+        m_device = socket;
+        socket->connectToServer(source.mid(5));
+        return true;
+    }
+    else
+    {   //unbuffered so a read at the end picks up whatever has been written since
+        QFile *file = new QFile(source, this);
+        if(!file->open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+        {
+            emit failed(file->errorString());
+            delete file;
+            return false;
+        }
+        m_device = file;
+    }
+
+    m_timer.start();
+    return true;
+}
+
+void LogStream::stop(void)
+{
+    m_timer.stop();
+    QIODevice *device = m_device;
+    m_device = nullptr; //first, closing a socket that is still connecting reports an error
+    if(device)
+    {
+        device->close();
+        device->deleteLater();
+    }
+}
+
+void LogStream::connected(void)
+{
+    if(sender() == m_device)
+        m_timer.start();
+}
+
+//only errors before the socket is up, once polling poll() drains what is left and reports the close
+void LogStream::connectFailed(void)
+{
+    if((sender() != m_device) || m_timer.isActive())
+        return;
+    QString message = m_device->errorString();
+    stop();
+    emit failed(message);
+}
+
+void LogStream::poll(void)
+{
+    if(!m_device)
+        return;
+
+    if(m_pending.size() < STREAM_MAX_BATCH)
+        m_pending += m_device->read(STREAM_MAX_BATCH - m_pending.size());
+    int end = m_pending.lastIndexOf('\n') + 1;
+    if((end == 0) && (m_pending.size() >= STREAM_MAX_BATCH))
+    {
+        stop();
+        emit failed(tr("Stream is not a CSV log"));
+        return;
+    }
+    if(end > 0)
+    {
+        const char *p = m_pending.constData();
+        if(!m_haveHeader)
+        {
+            int eol = m_pending.indexOf('\n');
+            int skip = m_pending.startsWith("\xEF\xBB\xBF") ? 3 : 0; //UTF-8 BOM
+            if(!LogData::parseHeader(QString::fromUtf8(p + skip, eol - skip), &m_cols))
+            {
+                stop();
+                emit failed(tr("Stream does not contain required data fields"));
+                return;
+            }
+            m_haveHeader = true;
+            p += eol + 1;
+        }
+
+        int first = m_data->size();
+        int added = m_data->appendLines(p, m_pending.constData() + end, m_cols);
+        m_pending.remove(0, end);
+        if(added)
+            emit rowsAdded(first, added);
+    }
+
+    QAbstractSocket *tcp = qobject_cast<QAbstractSocket *>(m_device);
+    QLocalSocket *local = qobject_cast<QLocalSocket *>(m_device);
+    if((tcp && (tcp->state() == QAbstractSocket::UnconnectedState) && !tcp->bytesAvailable()) ||
+       (local && (local->state() == QLocalSocket::UnconnectedState) && !local->bytesAvailable()))
+    {
+        stop();
+        emit failed(tr("Stream closed"));
+    }
+}
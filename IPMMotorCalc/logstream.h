@@ -0,0 +1,62 @@
+/*
+ * This file is part of the IPMMotorCalc project
+ *
+ * Copyright (C) 2023 Pete9008 <openinverter.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOGSTREAM_H
+#define LOGSTREAM_H
+
+#include <QObject>
+#include <QFile>
+#include <QTimer>
+#include <QByteArray>
+#include "logdata.h"
+
+//Feeds a LogData from a log that is still being written. The source is either a CSV file that is tailed,
+//tcp://host:port or unix:name (QLocalSocket, a path on unix). Sockets carry the same CSV text as the web logger
+//writes, header line first. Input is parsed on a timer so the GUI gets the rows in batches, each one bounded by
+//STREAM_MAX_BATCH bytes so a backlog is worked off over several ticks rather than stalling the event loop. Sockets
+//connect without blocking, start() returns straight away and failed() follows if the connection can't be made.
+class LogStream : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LogStream(LogData *data, QObject *parent = nullptr);
+    ~LogStream();
+    bool start(QString source);
+    void stop(void);
+    bool isRunning(void) const {return m_device != nullptr;}
+
+signals:
+    void rowsAdded(int first, int count);
+    void failed(QString message);
+
+private slots:
+    void poll(void);
+    void connected(void);
+    void connectFailed(void);
+
+private:
+    LogData *m_data;
+    QIODevice *m_device;
+    QByteArray m_pending; //read but not yet a complete line
+    log_columns m_cols;
+    bool m_haveHeader;
+    QTimer m_timer;
+};
+
+#endif // LOGSTREAM_H
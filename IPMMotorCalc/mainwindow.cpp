@@ -21,10 +21,10 @@
 #include "ui_mainwindow.h"
 #include <QFileDialog>
 #include <QSettings>
-#include <QTextStream>
 #include <QMessageBox>
-#include <QDateTime>
 #include <QtMath>
+#include <QtConcurrent>
+#include <QSharedPointer>
 
 //Most graphs
 #define IQ 1
@@ -39,6 +39,24 @@
 #define RS 3
 #define FL 4
 #define KG 5
+#define RESVD 6
+#define RESVQ 7
+#define TRK_RS 8
+#define TRK_LD 9
+#define TRK_LQ 10
+#define TRK_FL 11
+#define SAT_LD 12
+#define SAT_LQ 13
+#define SAT_FL 14
+#define INST_LD 15
+#define INST_LQ 16
+#define INST_RS 17
+#define INST_FL 18
+
+#define AUTOTUNE_STEP 10 //initial simplex step in percent, --joint on the command line
+
+#define SAT_ID_BINS 10
+#define SAT_IQ_BINS 10
 
 
 MainWindow::MainWindow(QWidget *parent) :
@@ -46,6 +64,7 @@ MainWindow::MainWindow(QWidget *parent) :
     ui(new Ui::MainWindow)
 {
     ui->setupUi(this);
+    m_saturation.valid = false;
 
     QSettings settings("OpenInverter", "IPMMotorCalc");
     restoreGeometry(settings.value("mainwin/geometry").toByteArray());
@@ -62,6 +81,10 @@ MainWindow::MainWindow(QWidget *parent) :
     if(settings.contains(ui->Ld->objectName())) ui->Ld->setText(settings.value(ui->Ld->objectName(),QString()).toString());
     if(settings.contains(ui->Rs->objectName())) ui->Rs->setText(settings.value(ui->Rs->objectName(),QString()).toString());
     if(settings.contains(ui->FluxLinkage->objectName())) ui->FluxLinkage->setText(settings.value(ui->FluxLinkage->objectName(),QString()).toString());
+    if(settings.contains(ui->cb_DynamicModel->objectName())) ui->cb_DynamicModel->setChecked(settings.value(ui->cb_DynamicModel->objectName(),false).toBool());
+    if(settings.contains(ui->cb_AdaptiveSearch->objectName())) ui->cb_AdaptiveSearch->setChecked(settings.value(ui->cb_AdaptiveSearch->objectName(),false).toBool());
+    if(settings.contains(ui->cb_InstantCurves->objectName())) ui->cb_InstantCurves->setChecked(settings.value(ui->cb_InstantCurves->objectName(),false).toBool());
+    if(settings.contains(ui->le_Forgetting->objectName())) ui->le_Forgetting->setText(settings.value(ui->le_Forgetting->objectName(),QString()).toString());
 
     inputGraph = new DataGraph("input", this);
     inputGraph->setWindowTitle("Input Data");
@@ -85,9 +108,13 @@ MainWindow::MainWindow(QWidget *parent) :
     modelGraph->addSeries("Vq (V)", axis_left, VQ);
     modelGraph->addSeries("Vd (V)", axis_left, VD);
     modelGraph->addSeries("Frq (Hz)", axis_right, FRQ);
+    modelGraph->addSeries("Iq (A)", axis_left, IQ);
+    modelGraph->addSeries("Id (A)", axis_left, ID);
     modelGraph->setColour(Qt::blue, VQ);
     modelGraph->setColour(Qt::red, VD);
     modelGraph->setColour(Qt::darkGreen, FRQ);
+    modelGraph->setColour(Qt::cyan, IQ);
+    modelGraph->setColour(Qt::magenta, ID);
     modelGraph->updateGraph();
     modelGraph->show();
 
@@ -97,19 +124,39 @@ MainWindow::MainWindow(QWidget *parent) :
     errorGraph->addSeries("Vq (V)", axis_left, VQ);
     errorGraph->addSeries("Vd (V)", axis_left, VD);
     errorGraph->addSeries("Frq (Hz)", axis_right, FRQ);
+    errorGraph->addSeries("Iq (A)", axis_left, IQ);
+    errorGraph->addSeries("Id (A)", axis_left, ID);
     errorGraph->setColour(Qt::blue, VQ);
     errorGraph->setColour(Qt::red, VD);
     errorGraph->setColour(Qt::darkGreen, FRQ);
+    errorGraph->setColour(Qt::cyan, IQ);
+    errorGraph->setColour(Qt::magenta, ID);
     errorGraph->updateGraph();
     errorGraph->show();
 
     resultsGraph = new DataGraph("results", this);
     resultsGraph->setWindowTitle("Results");
-    resultsGraph->setAxisText("", "Error", "");
+    resultsGraph->setAxisText("", "Replay error", "Instant rms error (V)");
     resultsGraph->addSeries("Ld (mH)", axis_left, LD);
     resultsGraph->addSeries("Lq (mH)", axis_left, LQ);
     resultsGraph->addSeries("Rs (mR)", axis_left, RS);
     resultsGraph->addSeries("λ (mWb)", axis_left, FL);
+    resultsGraph->addSeries("Vd residual (V)", axis_left, RESVD);
+    resultsGraph->addSeries("Vq residual (V)", axis_left, RESVQ);
+    resultsGraph->addSeries("Rs tracked (mR)", axis_left, TRK_RS);
+    resultsGraph->addSeries("Ld tracked (mH)", axis_left, TRK_LD);
+    resultsGraph->addSeries("Lq tracked (mH)", axis_left, TRK_LQ);
+    resultsGraph->addSeries("λ tracked (mWb)", axis_left, TRK_FL);
+    resultsGraph->addSeries("Ld(Id) (mH)", axis_left, SAT_LD);
+    resultsGraph->addSeries("Lq(Iq) (mH)", axis_left, SAT_LQ);
+    resultsGraph->addSeries("λ(Iq) (mWb)", axis_left, SAT_FL);
+    //instant curves are rms volts rather than summed replay errors so they get the right hand axis
+    resultsGraph->addSeries("Ld instant (mH)", axis_right, INST_LD);
+    resultsGraph->addSeries("Lq instant (mH)", axis_right, INST_LQ);
+    resultsGraph->addSeries("Rs instant (mR)", axis_right, INST_RS);
+    resultsGraph->addSeries("λ instant (mWb)", axis_right, INST_FL);
+    resultsGraph->setColour(Qt::red, RESVD);
+    resultsGraph->setColour(Qt::blue, RESVQ);
     resultsGraph->updateGraph();
     resultsGraph->show();
 
@@ -124,15 +171,72 @@ MainWindow::MainWindow(QWidget *parent) :
 
     motor = new MotorModel(m_wheelSize,m_gearRatio,0,m_vehicleWeight,m_Lq,m_Ld,m_Rs,m_Poles,m_fluxLinkage,0.001,0,1);
 
+    //tunes run on the thread pool, progress and cancel live in the status bar while one is going
+    m_job = new TuneJob(this);
+    m_jobProgress = new QProgressBar(this);
+    m_jobCancel = new QPushButton(tr("Cancel"), this);
+    ui->statusBar->addPermanentWidget(m_jobProgress);
+    ui->statusBar->addPermanentWidget(m_jobCancel);
+    m_jobProgress->hide();
+    m_jobCancel->hide();
+    connect(m_jobCancel, &QPushButton::clicked, m_job, &TuneJob::cancel);
+    connect(m_job, &TuneJob::progressChanged, this, &MainWindow::jobProgress);
+    connect(m_job, &TuneJob::candidateFound, this, &MainWindow::jobCandidate);
+    connect(&m_jobWatcher, &QFutureWatcher<void>::finished, this, &MainWindow::jobDone);
+    m_resultsDirty = false;
+    m_resultsTimer.setInterval(100);
+    connect(&m_resultsTimer, &QTimer::timeout, this, &MainWindow::refreshResults);
+
+    for(int param=tune_Lq; param<=tune_FL; param++)
+        m_instantCurve[param] = false;
+
+    m_stream = new LogStream(&fdata, this);
+    m_streamReplayed = 0;
+    m_streamModel = new MotorModel(*motor);
+    m_streamCursor = {false, 0};
+    connect(m_stream, &LogStream::rowsAdded, this, &MainWindow::streamRows);
+    connect(m_stream, &LogStream::failed, this, &MainWindow::streamFailed);
+    connect(inputGraph, &DataGraph::windowChanged, this, &MainWindow::inputWindowChanged);
+
+#ifdef IPM_PERFSTATS
+    //instrumented build, the busiest phases in the status bar and a button to save the lot as JSON
+    m_perfLabel = new QLabel(this);
+    m_perfLabel->setMaximumWidth(600);
+    QPushButton *perfSave = new QPushButton(tr("Save Stats"), this);
+    ui->statusBar->addPermanentWidget(m_perfLabel);
+    ui->statusBar->addPermanentWidget(perfSave);
+    connect(perfSave, &QPushButton::clicked, this, [this]()
+    {
+        QString fileName = QFileDialog::getSaveFileName(this, tr("Save Stats"), "perfstats.json", tr("JSON Files (*.json)"));
+        if(!fileName.isEmpty() && !PerfStats::dump(fileName))
+            QMessageBox::warning(this, tr("IPMMotorCalc"), tr("Unable to write %1").arg(fileName));
+    });
+    m_perfTimer.setInterval(1000);
+    connect(&m_perfTimer, &QTimer::timeout, this, [this]()
+    {
+        QString summary = PerfStats::summary();
+        m_perfLabel->setText(summary);
+        m_perfLabel->setToolTip(summary);
+    });
+    m_perfTimer.start();
+#endif
 }
 
 MainWindow::~MainWindow()
 {
+    delete m_streamModel;
     delete ui;
 }
 
 void MainWindow::closeEvent(QCloseEvent *event)
 {
+    m_stream->stop();
+    if(m_jobWatcher.isRunning())
+    {   //the job reads fdata so it has to stop before anything goes away
+        m_job->cancel();
+        m_jobWatcher.waitForFinished();
+    }
+
     QSettings settings("OpenInverter", "IPMMotorCalc");
     settings.setValue("mainwin/geometry", saveGeometry());
     settings.setValue("mainwin/windowState", saveState());
@@ -148,6 +252,10 @@ void MainWindow::closeEvent(QCloseEvent *event)
     settings.setValue(ui->Ld->objectName(), ui->Ld->text());
     settings.setValue(ui->Rs->objectName(), ui->Rs->text());
     settings.setValue(ui->FluxLinkage->objectName(), ui->FluxLinkage->text());
+    settings.setValue(ui->cb_DynamicModel->objectName(), ui->cb_DynamicModel->isChecked());
+    settings.setValue(ui->cb_AdaptiveSearch->objectName(), ui->cb_AdaptiveSearch->isChecked());
+    settings.setValue(ui->cb_InstantCurves->objectName(), ui->cb_InstantCurves->isChecked());
+    settings.setValue(ui->le_Forgetting->objectName(), ui->le_Forgetting->text());
 
     inputGraph->saveWinState();
     modelGraph->saveWinState();
@@ -158,83 +266,56 @@ void MainWindow::closeEvent(QCloseEvent *event)
 }
 
 
-void MainWindow::on_pb_selectFile_clicked()
+void MainWindow::resetGraphs(void)
 {
-    struct file_data ipline;
-    int timepos, idpos, iqpos, udpos, uqpos, frqpos, udcpos;
-    QStringList fieldList;
-
-    QString fileName = QFileDialog::getOpenFileName(this, tr("Open CSV"), ui->le_filename->text(), tr("CSV Files (*.csv)"));
-    ui->le_filename->setText(fileName);
-
-    fdata.clear();
     inputGraph->clearData();
     modelGraph->clearData();
     errorGraph->clearData();
     resultsGraph->clearData();
+    m_index.clear();
     listLd.clear();
     listLq.clear();
     listRs.clear();
     listFL.clear();
+    listResVd.clear();
+    listResVq.clear();
+    m_track = rls_trace();
+    listSatLd.clear();
+    listSatLq.clear();
+    listSatFL.clear();
+}
 
-    QFile inFile(fileName);
-    inFile.open(QIODevice::ReadOnly);
-    QTextStream sIn(&inFile);
-    QString s=sIn.readLine(); //get column defs
-    fieldList = s.split(u',');
-    timepos = fieldList.indexOf("Timestamp");
-    udcpos = fieldList.indexOf("udc");
-    idpos = fieldList.indexOf("id");
-    iqpos = fieldList.indexOf("iq");
-    udpos = fieldList.indexOf("ud");
-    uqpos = fieldList.indexOf("uq");
-    frqpos = fieldList.indexOf("fstat");
-    if((timepos>=0) && (udcpos>=0) && (idpos>=0) && (iqpos>=0) && (udpos>=0) && (uqpos>=0) && (frqpos>=0))
-    {//have all required fields so check order
-        QList<QPointF> listIq, listId, listVq, listVd, listFrq;
-        bool firstTime = true;
-        qint64 startTime = 0;
-        while (!sIn.atEnd())
-        {
-          QString s=sIn.readLine();
-          fieldList = s.split(u',');
-          QString format = "yyyy-MM-ddTHH:mm:ss.zzz";
-          QDateTime dt = QDateTime::fromString (fieldList[timepos], format);
-          if(firstTime)
-          {
-            ipline.time = 0;
-            startTime = dt.toMSecsSinceEpoch();
-            firstTime = false;
-          }
-          else
-            ipline.time = dt.toMSecsSinceEpoch() - startTime;
-
-          double voltageDiv2 = fieldList[udcpos].toDouble()/2.0;
-          ipline.id = fieldList[idpos].toDouble();
-          ipline.iq = fieldList[iqpos].toDouble();
-          ipline.ud = (voltageDiv2/32768)*fieldList[udpos].toDouble();
-          ipline.uq = (voltageDiv2/32768)*fieldList[uqpos].toDouble();
-          ipline.frq = fieldList[frqpos].toDouble();
-          double secTime = ipline.time/1000.0;
-          listId.append(QPointF(secTime, ipline.id));
-          listIq.append(QPointF(secTime, ipline.iq));
-          listVd.append(QPointF(secTime, ipline.ud));
-          listVq.append(QPointF(secTime, ipline.uq));
-          listFrq.append(QPointF(secTime, ipline.frq));
-
-          fdata.push_back(ipline);
-        }
-        inputGraph->addDataPoints(listId, ID);
-        inputGraph->addDataPoints(listIq, IQ);
-        inputGraph->addDataPoints(listVd, VD);
-        inputGraph->addDataPoints(listVq, VQ);
-        inputGraph->addDataPoints(listFrq, FRQ);
+//the input graph draws straight from fdata rather than holding its own copy of the log
+void MainWindow::setLogViews(void)
+{
+    inputGraph->setLogView(&fdata, chan_id, ID);
+    inputGraph->setLogView(&fdata, chan_iq, IQ);
+    inputGraph->setLogView(&fdata, chan_ud, VD);
+    inputGraph->setLogView(&fdata, chan_uq, VQ);
+    inputGraph->setLogView(&fdata, chan_frq, FRQ);
+}
+
+void MainWindow::on_pb_selectFile_clicked()
+{
+    QString fileName = QFileDialog::getOpenFileName(this, tr("Open CSV"), ui->le_filename->text(), tr("CSV Files (*.csv)"));
+    ui->le_filename->setText(fileName);
+    PERF_SCOPE("gui.selectFile"); //from here, not the time spent in the dialog
+
+    resetGraphs();
+
+    if(fdata.loadCsv(fileName))
+    {
+        m_index.build(&fdata);
+        setLogViews();
         inputGraph->updateGraph();
         modelGraph->updateGraph();
         errorGraph->updateGraph();
         resultsGraph->updateGraph();
         ui->pb_Run->setEnabled(true);
         ui->pb_AutoTune->setEnabled(true);
+        ui->pb_LeastSquares->setEnabled(true);
+        ui->pb_Track->setEnabled(true);
+        ui->pb_Saturation->setEnabled(true);
         ui->pb_TuneFL->setEnabled(true);
         ui->pb_TuneLd->setEnabled(true);
         ui->pb_TuneLq->setEnabled(true);
@@ -248,6 +329,9 @@ void MainWindow::on_pb_selectFile_clicked()
         ui->le_filename->setText("");
         ui->pb_Run->setEnabled(false);
         ui->pb_AutoTune->setEnabled(false);
+        ui->pb_LeastSquares->setEnabled(false);
+        ui->pb_Track->setEnabled(false);
+        ui->pb_Saturation->setEnabled(false);
         ui->pb_TuneFL->setEnabled(false);
         ui->pb_TuneLd->setEnabled(false);
         ui->pb_TuneLq->setEnabled(false);
@@ -257,253 +341,352 @@ void MainWindow::on_pb_selectFile_clicked()
         ui->pb_CopyLq->setEnabled(false);
         ui->pb_CopyRs->setEnabled(false);
     }
-    inFile.close();
 }
 
-void MainWindow::on_pb_Run_clicked()
+//Runs work on the thread pool with a tuner set up for the current window, finished is called back on the GUI
+//thread unless the job was cancelled. Anything work fills in has to be owned by the lambdas, not the stack.
+void MainWindow::startJob(QString name, std::function<void(const MotorTuner &)> work, std::function<void(void)> finished)
 {
-    QList<QPointF> listVq, listVd, listFrq;
-    QList<QPointF> listEVq, listEVd, listEFrq;
-
-    motor->Restart();
-    m_timenow = 0;
-    modelGraph->clearData();
-    errorGraph->clearData();
-
     double xmin, xmax;
     inputGraph->queryXaxis(&xmin, &xmax);
-    for(int i=0; i<fdata.size()-1; i++)
+    QSharedPointer<MotorTuner> tuner(new MotorTuner(&fdata));
+    tuner->setWindow(xmin, xmax);
+    tuner->setAdaptiveSearch(ui->cb_AdaptiveSearch->isChecked());
+    tuner->setMonitor(m_job);
+    tuner->setIndex(&m_index);
+
+    m_job->reset();
+    m_jobName = name;
+    m_jobFinished = finished;
+    setJobRunning(true);
+    ui->statusBar->showMessage(tr("%1 running").arg(name));
+    m_jobWatcher.setFuture(QtConcurrent::run([tuner, work]()
     {
-        if((fdata[i].time >= (1000*xmin)) && (fdata[i].time <= (1000*xmax)))
-        {
-            do
-            {
-                motor->setSpeedFromElecFreq(fdata[i].frq);//prevent cumulative drift
-                motor->Step(fdata[i].iq, fdata[i].id);
-                m_timenow++;
-            }
-            while(m_timenow < fdata[i+1].time);
-
-            double error_vq = motor->getVq() - fdata[i].uq;
-            double error_vd = motor->getVd() - fdata[i].ud;
-            double error_frq = motor->getElecFreq() - fdata[i+1].frq;
-
-            double secTime = m_timenow/1000.0;
-            listEVd.append(QPointF(secTime, error_vd));
-            listEVq.append(QPointF(secTime, error_vq));
-            listEFrq.append(QPointF(secTime, error_frq));
-            listVd.append(QPointF(secTime, motor->getVd()));
-            listVq.append(QPointF(secTime, motor->getVq()));
-            listFrq.append(QPointF(secTime, motor->getElecFreq()));
-        }
-    }
+        work(*tuner);
+    }));
+}
 
-    errorGraph->addDataPoints(listEVd, VD);
-    errorGraph->addDataPoints(listEVq, VQ);
-    errorGraph->addDataPoints(listEFrq, FRQ);
-    errorGraph->updateGraph();
+void MainWindow::setJobRunning(bool running)
+{
+    m_jobProgress->setRange(0, 0); //busy until the first progress report
+    m_jobProgress->setVisible(running);
+    m_jobCancel->setVisible(running);
+    ui->pb_selectFile->setEnabled(!running);
+    ui->pb_Live->setEnabled(!running);
+    ui->pb_Run->setEnabled(!running);
+    ui->pb_AutoTune->setEnabled(!running);
+    ui->pb_LeastSquares->setEnabled(!running);
+    ui->pb_Track->setEnabled(!running);
+    ui->pb_Saturation->setEnabled(!running);
+    ui->pb_TuneFL->setEnabled(!running);
+    ui->pb_TuneLd->setEnabled(!running);
+    ui->pb_TuneLq->setEnabled(!running);
+    ui->pb_TuneRs->setEnabled(!running);
+    if(running)
+        m_resultsTimer.start();
+    else
+        m_resultsTimer.stop();
+}
 
-    modelGraph->addDataPoints(listVd, VD);
-    modelGraph->addDataPoints(listVq, VQ);
-    modelGraph->addDataPoints(listFrq, FRQ);
-    modelGraph->updateGraph();
+void MainWindow::jobDone(void)
+{
+    setJobRunning(false);
+    if(m_job->isCancelled())
+    {
+        ui->statusBar->showMessage(tr("%1 cancelled").arg(m_jobName));
+        updateResultsGraph(); //drop any part curve
+    }
+    else
+    {
+        ui->statusBar->clearMessage();
+        m_jobFinished();
+    }
+    m_jobFinished = nullptr;
+}
 
+void MainWindow::jobProgress(int done, int total)
+{
+    m_jobProgress->setRange(0, total);
+    m_jobProgress->setValue(qMax(done, m_jobProgress->value())); //batches finish out of order
 }
 
-void MainWindow::on_pb_TuneLq_clicked()
+//sweep and search candidates are drawn as they are evaluated, the graph itself is redrawn on a timer
+void MainWindow::jobCandidate(int param, double value, double error)
 {
-    double minError = std::numeric_limits<double>::max();
-    double bestLq = 0;
+    static const int keys[] = {LQ, LD, RS, FL}; //in tuneParam order
+    resultsGraph->insertDataPoint(value*1000, error, keys[param]); //arrive in the order they finish
+    m_resultsDirty = true;
+}
 
-    motor->Restart();
-    m_timenow = 0;
-    resultsGraph->clearData();
-    listLq.clear();
-    double scale = ui->Lq_Delta->text().toDouble()/10000.0;
-    for(int percent=-100;percent<=100;percent++)
+void MainWindow::refreshResults(void)
+{
+    if(m_resultsDirty)
+        resultsGraph->updateGraph();
+    m_resultsDirty = false;
+}
+
+//Starts following le_filename as a live log, or stops if already following one. Tuning is left until it is
+//stopped as the jobs expect the log to stay put.
+void MainWindow::on_pb_Live_clicked()
+{
+    if(m_stream->isRunning())
     {
-        double Lq = m_Lq + (m_Lq * ((percent * scale)));
-        motor->setLq(Lq);
-        double totalError = 0;        
-        double xmin, xmax;
-        inputGraph->queryXaxis(&xmin, &xmax);
-        for(int i=0; i<fdata.size()-1; i++)
-        {
-            if((fdata[i].time >= (1000*xmin)) && (fdata[i].time <= (1000*xmax)))
-            {
-                do
-                {
-                    motor->setSpeedFromElecFreq(fdata[i].frq);//prevent cumulative drift
-                    motor->Step(fdata[i].iq, fdata[i].id);
-                    m_timenow++;
-                }
-                while(m_timenow < fdata[i+1].time);
-                double error_vd = motor->getVd() - fdata[i].ud;
-                totalError += qFabs(error_vd);
-            }
-        }
-        listLq.append(QPointF(Lq*1000, totalError));
-        if(totalError < minError)
-        {
-            minError = totalError;
-            bestLq = Lq;
-        }
+        m_stream->stop();
+        setStreaming(false);
+        return;
     }
-    resultsGraph->addDataPoints(listLd, LD);
-    resultsGraph->addDataPoints(listLq, LQ);
-    resultsGraph->addDataPoints(listRs, RS);
-    resultsGraph->addDataPoints(listFL, FL);
-    resultsGraph->updateGraph();
-    ui->Lq_BF->setText(QString::number(bestLq*1000));
-    motor->setLq(m_Lq);
-    ui->pb_CopyLq->setEnabled(true);
+
+    resetGraphs();
+    fdata.clear();
+    m_index.build(&fdata);
+    setLogViews();
+    resetTracking();
+    m_streamReplayed = 0;
+    m_streamModel->Restart();
+    m_streamCursor = {false, 0};
+    if(m_stream->start(ui->le_filename->text()))
+        setStreaming(true);
 }
 
-void MainWindow::on_pb_TuneLd_clicked()
+void MainWindow::setStreaming(bool streaming)
 {
-    double minError = std::numeric_limits<double>::max();
-    double bestLd = 0;
+    bool tune = !streaming && fdata.size();
+    ui->pb_Live->setText(streaming ? tr("Stop") : tr("Live"));
+    ui->pb_selectFile->setEnabled(!streaming);
+    ui->pb_Run->setEnabled(tune);
+    ui->pb_AutoTune->setEnabled(tune);
+    ui->pb_LeastSquares->setEnabled(tune);
+    ui->pb_Track->setEnabled(tune);
+    ui->pb_Saturation->setEnabled(tune);
+    ui->pb_TuneFL->setEnabled(tune);
+    ui->pb_TuneLd->setEnabled(tune);
+    ui->pb_TuneLq->setEnabled(tune);
+    ui->pb_TuneRs->setEnabled(tune);
+    if(streaming)
+        ui->statusBar->showMessage(tr("Following %1").arg(ui->le_filename->text()));
+}
 
-    motor->Restart();
-    m_timenow = 0;
-    resultsGraph->clearData();
-    listLd.clear();
-    double scale = ui->Ld_Delta->text().toDouble()/10000.0;
-    for(int percent=-100;percent<=100;percent++)
-    {
-        double Ld = m_Ld + (m_Ld * ((percent * scale)));
-        motor->setLd(Ld);
-        double totalError = 0;
-        double xmin, xmax;
-        inputGraph->queryXaxis(&xmin, &xmax);
-        for(int i=0; i<fdata.size()-1; i++)
-        {
-            if((fdata[i].time >= (1000*xmin)) && (fdata[i].time <= (1000*xmax)))
-            {
-                do
-                {
-                    motor->setSpeedFromElecFreq(fdata[i].frq);//prevent cumulative drift
-                    motor->Step(fdata[i].iq, fdata[i].id);
-                    m_timenow++;
-                }
-                while(m_timenow < fdata[i+1].time);
-                double error_vq = motor->getVq() - fdata[i].uq;
-                totalError += qFabs(error_vq);
-            }
-        }
-        listLd.append(QPointF(Ld*1000, totalError));
-        if(totalError < minError)
-        {
-            minError = totalError;
-            bestLd = Ld;
-        }
-    }
-    resultsGraph->addDataPoints(listLd, LD);
-    resultsGraph->addDataPoints(listLq, LQ);
-    resultsGraph->addDataPoints(listRs, RS);
-    resultsGraph->addDataPoints(listFL, FL);
+//Each batch from the stream is bounded so this is too. Rows are replayed once the next row is in (the replay compares
+//each row with the one after). The model's state and the replay cursor are carried from batch to batch so the result
+//is the same as replaying the whole log, while any parameters edited in the meantime take effect from the next batch.
+void MainWindow::streamRows(int first, int count)
+{
+    Q_UNUSED(first);
+    Q_UNUSED(count);
+    m_index.update();
+    inputGraph->updateGraph();
+
+    int end = fdata.size() - 1;
+    if(end <= m_streamReplayed)
+        return;
+
+    replay_trace trace;
+    MotorTuner tuner(&fdata);
+    tuner.setWindowRows(m_streamReplayed, end);
+    MotorModel model(*motor);
+    model.copyState(*m_streamModel);
+    if(ui->cb_DynamicModel->isChecked())
+        tuner.resumeReplayDynamic(model, &m_streamCursor, &trace);
+    else
+        tuner.resumeReplay(model, &m_streamCursor, &trace);
+    m_streamModel->copyState(model);
+    m_streamReplayed = end;
+
+    rls_trace track;
+    tuner.track(m_rls, &track);
+    m_track.Rs += track.Rs;
+    m_track.Ld += track.Ld;
+    m_track.Lq += track.Lq;
+    m_track.fluxLink += track.fluxLink;
+    resultsGraph->addDataPoints(track.Rs, TRK_RS);
+    resultsGraph->addDataPoints(track.Ld, TRK_LD);
+    resultsGraph->addDataPoints(track.Lq, TRK_LQ);
+    resultsGraph->addDataPoints(track.fluxLink, TRK_FL);
     resultsGraph->updateGraph();
-    ui->Ld_BF->setText(QString::number(bestLd*1000));
-    motor->setLd(m_Ld);
-    ui->pb_CopyLd->setEnabled(true);
+
+    errorGraph->addDataPoints(trace.errVd, VD);
+    errorGraph->addDataPoints(trace.errVq, VQ);
+    errorGraph->addDataPoints(trace.errFrq, FRQ);
+    errorGraph->addDataPoints(trace.errId, ID);
+    errorGraph->addDataPoints(trace.errIq, IQ);
+    errorGraph->updateGraph();
+
+    modelGraph->addDataPoints(trace.vd, VD);
+    modelGraph->addDataPoints(trace.vq, VQ);
+    modelGraph->addDataPoints(trace.frq, FRQ);
+    modelGraph->addDataPoints(trace.id, ID);
+    modelGraph->addDataPoints(trace.iq, IQ);
+    modelGraph->updateGraph();
 }
 
-void MainWindow::on_pb_TuneRs_clicked()
+void MainWindow::streamFailed(QString message)
 {
-    double minError = std::numeric_limits<double>::max();
-    double bestRs = 0;
+    setStreaming(false);
+    ui->statusBar->showMessage(tr("Live log stopped: %1").arg(message));
+}
 
-    motor->Restart();
-    m_timenow = 0;
-    resultsGraph->clearData();
-    listRs.clear();
-    double scale = ui->Rs_Delta->text().toDouble()/10000.0;
-    for(int percent=-100;percent<=100;percent++)
+void MainWindow::on_pb_Run_clicked()
+{
+    modelGraph->clearData();
+    errorGraph->clearData();
+
+    MotorModel model(*motor);
+    bool dynamic = ui->cb_DynamicModel->isChecked();
+    QSharedPointer<replay_trace> trace(new replay_trace);
+    startJob(tr("Run"), [model, dynamic, trace](const MotorTuner &tuner)
+    {
+        MotorModel local(model);
+        if(dynamic)
+            tuner.replayDynamic(local, trace.data()); //voltages are the log's so only currents are plotted
+        else
+            tuner.replay(local, trace.data());
+    },
+    [this, trace]()
+    {
+        errorGraph->addDataPoints(trace->errVd, VD);
+        errorGraph->addDataPoints(trace->errVq, VQ);
+        errorGraph->addDataPoints(trace->errFrq, FRQ);
+        errorGraph->addDataPoints(trace->errId, ID);
+        errorGraph->addDataPoints(trace->errIq, IQ);
+        errorGraph->updateGraph();
+
+        modelGraph->addDataPoints(trace->vd, VD);
+        modelGraph->addDataPoints(trace->vq, VQ);
+        modelGraph->addDataPoints(trace->frq, FRQ);
+        modelGraph->addDataPoints(trace->id, ID);
+        modelGraph->addDataPoints(trace->iq, IQ);
+        modelGraph->updateGraph();
+    });
+}
+
+void MainWindow::startSweep(tuneParam param, double deltaPercent)
+{
+    if(ui->cb_InstantCurves->isChecked())
     {
-        double Rs = m_Rs + (m_Rs * ((percent * scale)));
-        motor->setRs(Rs);
-        double totalError = 0;
-        double xmin, xmax;
-        inputGraph->queryXaxis(&xmin, &xmax);
-        for(int i=0; i<fdata.size()-1; i++)
-        {
-            if((fdata[i].time >= (1000*xmin)) && (fdata[i].time <= (1000*xmax)))
-            {
-                do
-                {
-                    motor->setSpeedFromElecFreq(fdata[i].frq);//prevent cumulative drift
-                    motor->Step(fdata[i].iq, fdata[i].id);
-                    m_timenow++;
-                }
-                while(m_timenow < fdata[i+1].time);
-                double error_v = (qFabs(motor->getVq() - fdata[i].uq) + qFabs(motor->getVd() - fdata[i].ud))/2.0;
-                totalError += error_v;
-            }
-        }
-        listRs.append(QPointF(Rs*1000, totalError));
-        if(totalError < minError)
-        {
-            minError = totalError;
-            bestRs = Rs;
-        }
+        quickSweep(param);
+        return;
     }
-    resultsGraph->addDataPoints(listLd, LD);
-    resultsGraph->addDataPoints(listLq, LQ);
-    resultsGraph->addDataPoints(listRs, RS);
-    resultsGraph->addDataPoints(listFL, FL);
-    resultsGraph->updateGraph();
-    ui->Rs_BF->setText(QString::number(bestRs*1000));
-    motor->setRs(m_Rs);
-    ui->pb_CopyRs->setEnabled(true);
+
+    //the old curve for this parameter goes, the new one is drawn as it comes in
+    QList<QPointF> *lists[] = {&listLq, &listLd, &listRs, &listFL}; //in tuneParam order
+    lists[param]->clear();
+    listResVd.clear();
+    listResVq.clear();
+    m_track = rls_trace();
+    listSatLd.clear();
+    listSatLq.clear();
+    listSatFL.clear();
+    updateResultsGraph();
+
+    MotorModel model(*motor);
+    QSharedPointer<sweep_result> result(new sweep_result);
+    startJob(tr("Tune"), [model, param, deltaPercent, result](const MotorTuner &tuner)
+    {
+        *result = tuner.tune(model, param, deltaPercent);
+    },
+    [this, param, result]()
+    {
+        finishSweep(param, *result);
+    });
 }
 
-void MainWindow::on_pb_TuneFL_clicked()
+//Curve from the prefix sums rather than replays, quick enough to run on the GUI thread every time the window moves
+void MainWindow::quickSweep(tuneParam param)
 {
-    double minError = std::numeric_limits<double>::max();
-    double bestFL = 0;
+    const QLineEdit *deltas[] = {ui->Lq_Delta, ui->Ld_Delta, ui->Rs_Delta, ui->FluxLinkage_Delta}; //in tuneParam order
+    double xmin, xmax;
+    inputGraph->queryXaxis(&xmin, &xmax);
+    MotorTuner tuner(&fdata);
+    tuner.setWindow(xmin, xmax);
+    tuner.setIndex(&m_index);
+
+    listResVd.clear();
+    listResVq.clear();
+    m_track = rls_trace();
+    listSatLd.clear();
+    listSatLq.clear();
+    listSatFL.clear();
+    finishSweep(param, tuner.quickSweep(*motor, param, deltas[param]->text().toDouble()), true);
+}
 
-    motor->Restart();
-    m_timenow = 0;
-    resultsGraph->clearData();
-    listFL.clear();
-    double scale = ui->FluxLinkage_Delta->text().toDouble()/10000.0;
-    for(int percent=-100;percent<=100;percent++)
+//redraw whichever instant curves are showing for the new window
+void MainWindow::inputWindowChanged(void)
+{
+    if(!ui->cb_InstantCurves->isChecked() || m_jobWatcher.isRunning() || m_stream->isRunning() || !fdata.size())
+        return;
+    const QList<QPointF> *lists[] = {&listLq, &listLd, &listRs, &listFL}; //in tuneParam order
+    for(int param=tune_Lq; param<=tune_FL; param++)
+        if(m_instantCurve[param] && !lists[param]->isEmpty())
+            quickSweep((tuneParam)param);
+}
+
+void MainWindow::finishSweep(tuneParam param, const sweep_result &result, bool instant)
+{
+    m_instantCurve[param] = instant;
+    switch(param)
     {
-        double FLink = m_fluxLinkage + (m_fluxLinkage * ((percent * scale)));
-        motor->setFluxLinkage(FLink);
-        double totalError = 0;
-        double xmin, xmax;
-        inputGraph->queryXaxis(&xmin, &xmax);
-        for(int i=0; i<fdata.size()-1; i++)
-        {
-            if((fdata[i].time >= (1000*xmin)) && (fdata[i].time <= (1000*xmax)))
-            {
-                do
-                {
-                    motor->setSpeedFromElecFreq(fdata[i].frq);//prevent cumulative drift
-                    motor->Step(fdata[i].iq, fdata[i].id);
-                    m_timenow++;
-                }
-                while(m_timenow < fdata[i+1].time);
-                double error_v = qFabs(motor->getVq() - fdata[i].uq);
-                totalError += error_v;
-            }
-        }
-        listFL.append(QPointF(FLink*1000, totalError));
-        if(totalError < minError)
-        {
-            minError = totalError;
-            bestFL = FLink;
-        }
+    case tune_Lq:
+        listLq = result.errorCurve;
+        ui->Lq_BF->setText(QString::number(result.best*1000));
+        ui->pb_CopyLq->setEnabled(true);
+        break;
+    case tune_Ld:
+        listLd = result.errorCurve;
+        ui->Ld_BF->setText(QString::number(result.best*1000));
+        ui->pb_CopyLd->setEnabled(true);
+        break;
+    case tune_Rs:
+        listRs = result.errorCurve;
+        ui->Rs_BF->setText(QString::number(result.best*1000));
+        ui->pb_CopyRs->setEnabled(true);
+        break;
+    case tune_FL:
+        listFL = result.errorCurve;
+        ui->FluxLinkage_BF->setText(QString::number(result.best*1000));
+        ui->pb_CopyFL->setEnabled(true);
+        break;
     }
-    resultsGraph->addDataPoints(listLd, LD);
-    resultsGraph->addDataPoints(listLq, LQ);
-    resultsGraph->addDataPoints(listRs, RS);
-    resultsGraph->addDataPoints(listFL, FL);
+    updateResultsGraph();
+}
+
+//sweep error curves are plotted against the parameter value, least squares residuals and tracked parameters against time, so only one set is shown at once
+void MainWindow::updateResultsGraph(void)
+{
+    resultsGraph->clearData();
+    resultsGraph->addDataPoints(listResVd, RESVD);
+    resultsGraph->addDataPoints(listResVq, RESVQ);
+    resultsGraph->addDataPoints(listLd, m_instantCurve[tune_Ld] ? INST_LD : LD);
+    resultsGraph->addDataPoints(listLq, m_instantCurve[tune_Lq] ? INST_LQ : LQ);
+    resultsGraph->addDataPoints(listRs, m_instantCurve[tune_Rs] ? INST_RS : RS);
+    resultsGraph->addDataPoints(listFL, m_instantCurve[tune_FL] ? INST_FL : FL);
+    resultsGraph->addDataPoints(m_track.Rs, TRK_RS);
+    resultsGraph->addDataPoints(m_track.Ld, TRK_LD);
+    resultsGraph->addDataPoints(m_track.Lq, TRK_LQ);
+    resultsGraph->addDataPoints(m_track.fluxLink, TRK_FL);
+    resultsGraph->addDataPoints(listSatLd, SAT_LD);
+    resultsGraph->addDataPoints(listSatLq, SAT_LQ);
+    resultsGraph->addDataPoints(listSatFL, SAT_FL);
     resultsGraph->updateGraph();
-    ui->FluxLinkage_BF->setText(QString::number(bestFL*1000));
-    motor->setFluxLinkage(m_fluxLinkage);
-    ui->pb_CopyFL->setEnabled(true);
+}
+
+void MainWindow::on_pb_TuneLq_clicked()
+{
+    startSweep(tune_Lq, ui->Lq_Delta->text().toDouble());
+}
+
+void MainWindow::on_pb_TuneLd_clicked()
+{
+    startSweep(tune_Ld, ui->Ld_Delta->text().toDouble());
+}
+
+void MainWindow::on_pb_TuneRs_clicked()
+{
+    startSweep(tune_Rs, ui->Rs_Delta->text().toDouble());
+}
+
+void MainWindow::on_pb_TuneFL_clicked()
+{
+    startSweep(tune_FL, ui->FluxLinkage_Delta->text().toDouble());
 }
 
 void MainWindow::on_vehicleWeight_editingFinished()
@@ -579,14 +762,160 @@ void MainWindow::on_pb_CopyFL_clicked()
 }
 
 void MainWindow::on_pb_AutoTune_clicked()
-{   //run each tune 4 times, FL first as it impacts on the others more than they impact on it
-    for(int i=0;i<4;i++)
+{   //fit Ld, Lq and flux linkage together, starting from the current guesses. Rs is left alone as, like the old
+    //sequence, this is run on driving logs and Rs should come from a locked shaft log
+    QSharedPointer<MotorModel> fitted(new MotorModel(*motor));
+    QSharedPointer<joint_result> result(new joint_result);
+    startJob(tr("AutoTune"), [fitted, result](const MotorTuner &tuner)
     {
-        on_pb_TuneFL_clicked();
-        on_pb_CopyFL_clicked();
-        on_pb_TuneLd_clicked();
+        *result = tuner.jointTune(*fitted, AUTOTUNE_STEP, 0.0001, 1000, false);
+    },
+    [this, fitted, result]()
+    {
+        ui->Ld_BF->setText(QString::number(fitted->getLd()*1000));
+        ui->Lq_BF->setText(QString::number(fitted->getLq()*1000));
+        ui->FluxLinkage_BF->setText(QString::number(fitted->getFluxLinkage()*1000));
         on_pb_CopyLd_clicked();
-        on_pb_TuneLq_clicked();
         on_pb_CopyLq_clicked();
+        on_pb_CopyFL_clicked();
+
+        ui->statusBar->showMessage(tr("AutoTune %1 after %2 iterations (%3 replays) in %4 ms, error %5")
+                                   .arg(result->converged ? tr("converged") : tr("stopped"))
+                                   .arg(result->iterations).arg(result->evaluations).arg(result->elapsedMs).arg(result->error));
+    });
+}
+
+void MainWindow::on_pb_LeastSquares_clicked()
+{
+    double xmin, xmax;
+    inputGraph->queryXaxis(&xmin, &xmax);
+    MotorTuner tuner(&fdata);
+    tuner.setWindow(xmin, xmax);
+    lsq_result result = tuner.leastSquares();
+    if(!result.valid)
+    {
+        QMessageBox::warning(this, tr("IPMMotorCalc"),
+                                       tr("Unable to fit all four parameters.\n"
+                                          "The selected window needs both Id and Iq current with the motor spinning."));
+        return;
     }
+
+    listLd.clear();
+    listLq.clear();
+    listRs.clear();
+    listFL.clear();
+    listResVd = result.resVd;
+    listResVq = result.resVq;
+    m_track = rls_trace();
+    listSatLd.clear();
+    listSatLq.clear();
+    listSatFL.clear();
+    updateResultsGraph();
+
+    ui->Rs_BF->setText(QString::number(result.Rs*1000));
+    ui->Ld_BF->setText(QString::number(result.Ld*1000));
+    ui->Lq_BF->setText(QString::number(result.Lq*1000));
+    ui->FluxLinkage_BF->setText(QString::number(result.fluxLink*1000));
+    ui->pb_CopyRs->setEnabled(true);
+    ui->pb_CopyLd->setEnabled(true);
+    ui->pb_CopyLq->setEnabled(true);
+    ui->pb_CopyFL->setEnabled(true);
+}
+
+//table against current (A) in mH/mWb for the results graph
+static QList<QPointF> tablePoints(const param_table &table)
+{
+    QList<QPointF> points;
+    for(int i=0; i<table.values.size(); i++)
+        points.append(QPointF(table.start + (i * table.step), table.values[i]*1000));
+    return points;
+}
+
+//Ld against Id and Lq, λ against Iq over the window. The maps are handed to the model straight away, Rs is offered
+//like the other fits.
+void MainWindow::on_pb_Saturation_clicked()
+{
+    double xmin, xmax;
+    inputGraph->queryXaxis(&xmin, &xmax);
+    MotorTuner tuner(&fdata);
+    tuner.setWindow(xmin, xmax);
+    m_saturation = tuner.fitSaturation(SAT_ID_BINS, SAT_IQ_BINS);
+    if(!m_saturation.valid)
+    {
+        QMessageBox::warning(this, tr("IPMMotorCalc"),
+                                       tr("Unable to fit the saturation maps.\n"
+                                          "The selected window needs both Id and Iq current with the motor spinning."));
+        return;
+    }
+
+    listLd.clear();
+    listLq.clear();
+    listRs.clear();
+    listFL.clear();
+    listResVd.clear();
+    listResVq.clear();
+    m_track = rls_trace();
+    listSatLd = tablePoints(m_saturation.Ld);
+    listSatLq = tablePoints(m_saturation.Lq);
+    listSatFL = tablePoints(m_saturation.fluxLink);
+    updateResultsGraph();
+
+    ui->Rs_BF->setText(QString::number(m_saturation.Rs*1000));
+    ui->pb_CopyRs->setEnabled(true);
+    ui->cb_Saturation->setEnabled(true);
+    ui->cb_Saturation->setChecked(true);
+    on_cb_Saturation_toggled(true);
+    ui->statusBar->showMessage(tr("Saturation maps from %1 rows in %2 bins, rms residual %3 V")
+                               .arg(m_saturation.rows).arg(m_saturation.usedBins).arg(m_saturation.rms));
+}
+
+void MainWindow::on_cb_Saturation_toggled(bool checked)
+{
+    if(checked && m_saturation.valid)
+        motor->setSaturationMaps(m_saturation.Ld, m_saturation.Lq, m_saturation.fluxLink);
+    else
+        motor->clearSaturationMaps();
+}
+
+//online estimator starting from the current parameters
+void MainWindow::resetTracking(void)
+{
+    m_rls.reset(motor->getRs(), motor->getLd(), motor->getLq(), motor->getFluxLinkage());
+    m_rls.setForgetting(qBound(0.5, ui->le_Forgetting->text().toDouble(), 1.0));
+}
+
+void MainWindow::on_pb_Track_clicked()
+{
+    resetTracking();
+    QSharedPointer<RlsEstimator> rls(new RlsEstimator(m_rls));
+    QSharedPointer<rls_trace> trace(new rls_trace);
+    startJob(tr("Track"), [rls, trace](const MotorTuner &tuner)
+    {
+        tuner.track(*rls, trace.data());
+    },
+    [this, rls, trace]()
+    {
+        listLd.clear();
+        listLq.clear();
+        listRs.clear();
+        listFL.clear();
+        listResVd.clear();
+        listResVq.clear();
+        m_track = *trace;
+        listSatLd.clear();
+        listSatLq.clear();
+        listSatFL.clear();
+        updateResultsGraph();
+
+        //final estimates are offered the same way as the tunes
+        ui->Rs_BF->setText(QString::number(rls->getRs()*1000));
+        ui->Ld_BF->setText(QString::number(rls->getLd()*1000));
+        ui->Lq_BF->setText(QString::number(rls->getLq()*1000));
+        ui->FluxLinkage_BF->setText(QString::number(rls->getFluxLinkage()*1000));
+        ui->pb_CopyRs->setEnabled(true);
+        ui->pb_CopyLd->setEnabled(true);
+        ui->pb_CopyLq->setEnabled(true);
+        ui->pb_CopyFL->setEnabled(true);
+        ui->statusBar->showMessage(tr("Tracked %1 rows").arg(rls->getSamples()));
+    });
 }
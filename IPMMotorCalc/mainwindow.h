@@ -21,17 +21,19 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QFutureWatcher>
+#include <QProgressBar>
+#include <QPushButton>
+#include <QLabel>
+#include <QTimer>
+#include <functional>
 #include "datagraph.h"
 #include "motormodel.h"
-
-struct file_data {
-    qint64 time;
-    double id;
-    double iq;
-    double ud;
-    double uq;
-    double frq;
-};
+#include "logdata.h"
+#include "motortuner.h"
+#include "tunejob.h"
+#include "logstream.h"
+#include "perfstats.h"
 
 namespace Ui {
 class MainWindow;
@@ -46,13 +48,22 @@ private:
     DataGraph *errorGraph;
     DataGraph *modelGraph;
     DataGraph *resultsGraph;
-    QVector<file_data> fdata;
+    LogData fdata;
     MotorModel *motor;
-    qint64 m_timenow;
     QList<QPointF> listLd;
     QList<QPointF> listLq;
     QList<QPointF> listRs;
     QList<QPointF> listFL;
+    bool m_instantCurve[4]; //list above came from quickSweep, in tuneParam order
+    QList<QPointF> listResVd;
+    QList<QPointF> listResVq;
+    rls_trace m_track; //online estimates against time
+    RlsEstimator m_rls; //carried from batch to batch of a live log
+    ErrorIndex m_index; //prefix sums over fdata for the instant error curves
+    saturation_result m_saturation; //last saturation fit, used by the model while cb_Saturation is ticked
+    QList<QPointF> listSatLd; //tables against current
+    QList<QPointF> listSatLq;
+    QList<QPointF> listSatFL;
 
     double m_wheelSize;
     double m_vehicleWeight;
@@ -63,6 +74,25 @@ private:
     double m_Poles;
     double m_fluxLinkage;
 
+    TuneJob *m_job;
+    QFutureWatcher<void> m_jobWatcher;
+    QString m_jobName;
+    std::function<void(void)> m_jobFinished;
+    QProgressBar *m_jobProgress;
+    QPushButton *m_jobCancel;
+    QTimer m_resultsTimer;
+    bool m_resultsDirty;
+
+    LogStream *m_stream;
+    int m_streamReplayed; //rows of a live log already replayed into the model and error graphs
+    MotorModel *m_streamModel; //model state carried from batch to batch of a live log
+    replay_cursor m_streamCursor;
+
+#ifdef IPM_PERFSTATS
+    QLabel *m_perfLabel; //busiest phases, see perfstats.h
+    QTimer m_perfTimer;
+#endif
+
 public:
     explicit MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
@@ -106,9 +136,43 @@ private slots:
 
     void on_pb_AutoTune_clicked();
 
+    void on_pb_LeastSquares_clicked();
+
+    void on_pb_Track_clicked();
+
+    void on_pb_Saturation_clicked();
+
+    void on_cb_Saturation_toggled(bool checked);
+
+    void jobDone(void);
+
+    void jobProgress(int done, int total);
+
+    void jobCandidate(int param, double value, double error);
+
+    void refreshResults(void);
+
+    void on_pb_Live_clicked();
+
+    void streamRows(int first, int count);
+
+    void streamFailed(QString message);
+
+    void inputWindowChanged(void);
+
 private:
     Ui::MainWindow *ui;
     void closeEvent(QCloseEvent *bar);
+    void startJob(QString name, std::function<void(const MotorTuner &)> work, std::function<void(void)> finished);
+    void setJobRunning(bool running);
+    void setStreaming(bool streaming);
+    void resetGraphs(void);
+    void setLogViews(void);
+    void resetTracking(void);
+    void startSweep(tuneParam param, double deltaPercent);
+    void quickSweep(tuneParam param);
+    void finishSweep(tuneParam param, const sweep_result &result, bool instant = false);
+    void updateResultsGraph(void);
 
 };
 
@@ -18,10 +18,17 @@
  */
 
 #include "motormodel.h"
+#include <QtNumeric>
+
+//StepDynamic gives up after this many rejected steps in one call, a healthy step is rarely rejected more than a few times
+#define MAX_REJECTED_STEPS 1000
 
 MotorModel::MotorModel(double wheelSize,double ratio,double roadGradient,double mass,double Lq,double Ld,double Rs,double poles,double fluxLink,double timestep, double syncDelay, double sampPoint)
     :m_WheelSize{wheelSize},m_Ratio{ratio},m_RoadGradient{roadGradient},m_Mass{mass},m_Lq{Lq},m_Ld{Ld},m_Rs{Rs},m_Poles{poles},m_FluxLink{fluxLink}, m_syncdelay{syncDelay}, m_samplingPoint{sampPoint}, m_Timestep{timestep}
 {
+    m_DynamicTol = 1e-4;
+    m_Saturation = false;
+    updateGradientForce();
     Restart();
 }
 
@@ -34,16 +41,73 @@ void MotorModel::Restart(void)
     m_Iq = 0;
     m_Power = 0;
     m_Torque = 0;
+    m_VLd = 0;
+    m_VLq = 0;
+    m_DynamicStep = m_Timestep;
+    m_DynamicSteps = 0;
+}
+
+//carries a run on with different parameters, e.g. a live log replayed batch by batch while the fields are edited
+void MotorModel::copyState(const MotorModel &other)
+{
+    m_Position = other.m_Position;
+    m_Frequency = other.m_Frequency;
+    m_Speed = other.m_Speed;
+    m_Id = other.m_Id;
+    m_Iq = other.m_Iq;
+    m_Power = other.m_Power;
+    m_Torque = other.m_Torque;
+    m_Vd = other.m_Vd;
+    m_Vq = other.m_Vq;
+    m_VLd = other.m_VLd;
+    m_VLq = other.m_VLq;
+    m_DynamicStep = other.m_DynamicStep;
+    m_DynamicSteps = other.m_DynamicSteps;
+}
+
+//Saturation maps replace the fixed Ld, Lq and flux linkage until cleared, the fixed values are left as they were
+void MotorModel::setSaturationMaps(const param_table &Ld, const param_table &Lq, const param_table &fluxLink)
+{
+    m_LdMap = Ld;
+    m_LqMap = Lq;
+    m_FluxLinkMap = fluxLink;
+    m_Saturation = !Ld.values.isEmpty() && !Lq.values.isEmpty() && !fluxLink.values.isEmpty();
+}
+
+//parameters at the given currents
+inline void MotorModel::currentParams(double Iq, double Id, double *Lq, double *Ld, double *fluxLink) const
+{
+    if(m_Saturation)
+    {
+        *Ld = m_LdMap.lookup(Id);
+        *Lq = m_LqMap.lookup(Iq);
+        *fluxLink = m_FluxLinkMap.lookup(Iq);
+    }
+    else
+    {
+        *Ld = m_Ld;
+        *Lq = m_Lq;
+        *fluxLink = m_FluxLink;
+    }
 }
 
 void MotorModel::Step(double Iq, double Id)
+{
+    StepOutputs<AllOutputs>(Iq, Id);
+}
+
+template<class Outputs>
+void MotorModel::StepOutputs(double Iq, double Id)
 {
     m_Id = Id;
     m_Iq = Iq;
 
-    m_Vq_bemf = m_FluxLink * m_Poles * m_Frequency * 2 * M_PI;
-    m_Vq_dueto_id = m_Poles * m_Frequency * 2 * M_PI * m_Ld * m_Id;
-    m_Vd_dueto_iq = m_Poles * m_Frequency * 2 * M_PI * m_Lq * m_Iq;
+    double Lq, Ld, fluxLink;
+    currentParams(Iq, Id, &Lq, &Ld, &fluxLink);
+
+    m_Vq_bemf = fluxLink * m_Poles * m_Frequency * 2 * M_PI;
+    m_Vq_dueto_id = m_Poles * m_Frequency * 2 * M_PI * Ld * m_Id;
+    m_Vd_dueto_iq = m_Poles * m_Frequency * 2 * M_PI * Lq * m_Iq;
 
     m_Vd_dueto_Rd = (m_Rs * m_Id);
     m_Vq_dueto_Rq = (m_Rs * m_Iq);
@@ -57,7 +121,15 @@ void MotorModel::Step(double Iq, double Id)
 //    m_Id = m_Id + Id_delta;
 //    m_Iq = m_Iq + Iq_delta;
 
-    m_Torque = (3.0/2.0) * m_Poles * ((m_FluxLink * m_Iq) + ((m_Ld - m_Lq) * m_Id * m_Iq));
+    updateVehicle<Outputs>(m_Timestep, Lq, Ld, fluxLink);
+}
+
+//torque from the present currents and the parameters at them, then speed, frequency and (if wanted) power and position
+//after dt seconds
+template<class Outputs>
+void MotorModel::updateVehicle(double dt, double Lq, double Ld, double fluxLink)
+{
+    m_Torque = (3.0/2.0) * m_Poles * ((fluxLink * m_Iq) + ((Ld - Lq) * m_Id * m_Iq));
 
     //This is a very simple model just lumping everything together in a single vehicle mass
     //A better approach would be to have a fast and slow calculation
@@ -66,14 +138,16 @@ void MotorModel::Step(double Iq, double Id)
     //position delta from this component would be limited by a configurable driveshaft angular play parameter.
     //If added this would allow driveline shunt to be simulated by the model
     double wheelTorque = (m_Torque * m_Ratio) / m_WheelSize;//m_Wheelsize is radius (in m) to give N here
-    double gradientForce = -(qSin(qAtan(m_RoadGradient))*m_Mass*9.81);
-    double accelForce = wheelTorque + gradientForce;
+    double accelForce = wheelTorque + m_GradientForce;
     double accel = accelForce/m_Mass;
-    m_Speed = m_Speed + (accel * m_Timestep);
+    m_Speed = m_Speed + (accel * dt);
     m_Frequency = (m_Speed / (2.0 * M_PI * m_WheelSize)) * m_Ratio;
+    if(!Outputs::vehicle)
+        return;
+
     m_Power = 2.0 * M_PI * m_Frequency * m_Torque;
 
-    double posDelta = m_Frequency * m_Timestep * (360.0 * m_Poles);
+    double posDelta = m_Frequency * dt * (360.0 * m_Poles);
     m_Position = m_Position + posDelta;
 
     //leave wrapping the position till last to make the variable sampling point calculation easier
@@ -81,9 +155,95 @@ void MotorModel::Step(double Iq, double Id)
         m_Position = m_Position - (360.0 * m_Poles);
     if(m_Position<0)
         m_Position = m_Position + (360.0 * m_Poles);
+}
 
+//dq current derivatives for the applied voltages at electrical speed w (rad/s), the inductor voltages are m_VLd/m_VLq
+void MotorModel::currentDerivative(double Vq, double Vd, double w, double Iq, double Id, double *dIq, double *dId)
+{
+    double Lq, Ld, fluxLink;
+    currentParams(Iq, Id, &Lq, &Ld, &fluxLink);
+    *dId = (Vd - (m_Rs * Id) + (w * Lq * Iq)) / Ld;
+    *dIq = (Vq - (m_Rs * Iq) - (w * Ld * Id) - (w * fluxLink)) / Lq;
 }
 
+//Dynamic alternative to Step, the currents are state driven by the applied voltages Vq/Vd held for duration seconds
+//(speed is held over the interval too, so setSpeedFromElecFreq applies straight away). Integrated with the Bogacki-Shampine 3(2) pair, step size is chosen from the
+//embedded error estimate against m_DynamicTol and carried over to the next call so a steady log settles on a step
+//close to the electrical time constant rather than m_Timestep.
+//Returns false, with the currents left as NaN, if the inductances aren't positive or the integration can't converge
+//(non-finite derivatives or more than MAX_REJECTED_STEPS rejected steps), so a bad tuning candidate can't hang a replay.
+bool MotorModel::StepDynamic(double Vq, double Vd, double duration)
+{
+    m_Frequency = (m_Speed / (2.0 * M_PI * m_WheelSize)) * m_Ratio; //pick up any setSpeedFromElecFreq
+    const double w = m_Poles * m_Frequency * 2 * M_PI;
+    double Id = m_Id;
+    double Iq = m_Iq;
+    double t = 0;
+    double h = qMin(m_DynamicStep, duration);
+    double k1d, k1q, k2d, k2q, k3d, k3q, k4d, k4q;
+    int rejected = 0;
+
+    double Lq, Ld, fluxLink;
+    currentParams(Iq, Id, &Lq, &Ld, &fluxLink);
+    if(!(Lq > 0) || !(Ld > 0))
+    {
+        m_Id = m_Iq = qQNaN();
+        return false;
+    }
+
+    currentDerivative(Vq, Vd, w, Iq, Id, &k1q, &k1d);
+    while((duration - t) > 1e-12)
+    {
+        h = qMin(h, duration - t);
+        currentDerivative(Vq, Vd, w, Iq + (0.5 * h * k1q), Id + (0.5 * h * k1d), &k2q, &k2d);
+        currentDerivative(Vq, Vd, w, Iq + (0.75 * h * k2q), Id + (0.75 * h * k2d), &k3q, &k3d);
+        double newId = Id + (h * (((2.0/9.0) * k1d) + ((1.0/3.0) * k2d) + ((4.0/9.0) * k3d)));
+        double newIq = Iq + (h * (((2.0/9.0) * k1q) + ((1.0/3.0) * k2q) + ((4.0/9.0) * k3q)));
+        currentDerivative(Vq, Vd, w, newIq, newId, &k4q, &k4d);
+        //difference between the 3rd and embedded 2nd order solutions
+        double errId = h * (((-5.0/72.0) * k1d) + ((1.0/12.0) * k2d) + ((1.0/9.0) * k3d) - ((1.0/8.0) * k4d));
+        double errIq = h * (((-5.0/72.0) * k1q) + ((1.0/12.0) * k2q) + ((1.0/9.0) * k3q) - ((1.0/8.0) * k4q));
+        double scaleId = m_DynamicTol * (1.0 + qMax(qFabs(Id), qFabs(newId)));
+        double scaleIq = m_DynamicTol * (1.0 + qMax(qFabs(Iq), qFabs(newIq)));
+        double err = qMax(qFabs(errId) / scaleId, qFabs(errIq) / scaleIq);
+        if(!qIsFinite(err) || (!(err <= 1.0) && (++rejected > MAX_REJECTED_STEPS)))
+        {
+            m_Id = m_Iq = qQNaN();
+            return false;
+        }
+
+        if(err <= 1.0)
+        {   //accept, k4 is k1 of the next step
+            t += h;
+            Id = newId;
+            Iq = newIq;
+            k1d = k4d;
+            k1q = k4q;
+            m_DynamicSteps++;
+        }
+        double factor = (err > 0) ? 0.9 * qPow(err, -1.0/3.0) : 5.0;
+        h = h * qBound(0.2, factor, 5.0);
+        if(h < 1e-9)
+            h = 1e-9;
+        if((duration - t) > 1e-12)
+            m_DynamicStep = h;
+    }
+
+    m_Id = Id;
+    m_Iq = Iq;
+    m_Vd = Vd;
+    m_Vq = Vq;
+    currentParams(Iq, Id, &Lq, &Ld, &fluxLink);
+    m_VLd = Vd - (m_Rs * m_Id) + (w * Lq * m_Iq);
+    m_VLq = Vq - (m_Rs * m_Iq) - (w * Ld * m_Id) - (w * fluxLink);
+    updateVehicle<AllOutputs>(duration, Lq, Ld, fluxLink);
+    return true;
+}
+
+template void MotorModel::StepOutputs<AllOutputs>(double Iq, double Id);
+template void MotorModel::StepOutputs<VoltageOutputs>(double Iq, double Id);
+
+
 void MotorModel::setSpeedFromElecFreq(double val)
 {
     double shaftFreq = val / m_Poles;
@@ -21,26 +21,70 @@
 #define MOTORMODEL_H
 
 #include <QtMath>
+#include <QVector>
+
+//Output policies for MotorModel::StepOutputs, chosen at compile time.
+//Torque, speed and frequency are always needed as the next step's voltages depend on them.
+struct AllOutputs { static const bool vehicle = true; }; //power and position as well
+struct VoltageOutputs { static const bool vehicle = false; }; //just what the replay error measures need
+
+//A parameter as a function of one current. Evenly spaced points with linear interpolation between them, held flat
+//beyond the ends.
+struct param_table {
+    double start; //current at values[0] (A)
+    double step; //current between points (A)
+    QVector<double> values; //SI units
+
+    double lookup(double x) const
+    {
+        double pos = (x - start) / step;
+        if(pos <= 0)
+            return values.first();
+        int i = (int)pos;
+        if(i >= (values.size() - 1))
+            return values.last();
+        return values[i] + ((pos - i) * (values[i + 1] - values[i]));
+    }
+};
 
 class MotorModel
 {
 public:
     MotorModel(double wheelSize,double ratio,double roadGradient,double mass,double Lq,double Ld,double Rs,double poles,double fluxLink,double timestep, double syncDelay, double sampPoint);
     void Step(double Iq, double Id);
+    template<class Outputs> void StepOutputs(double Iq, double Id);
+    bool StepDynamic(double Vq, double Vd, double duration);
+    void setCurrents(double Iq, double Id) {m_Iq = Iq; m_Id = Id;}
+    void setDynamicTolerance(double val) {m_DynamicTol = val;}
+    quint64 getDynamicSteps(void) {return m_DynamicSteps;}
     void Restart(void);
+    void copyState(const MotorModel &other); //running state and last outputs, the parameters are left alone
     void setWheelSize(double val) {m_WheelSize = val;}
     void setGboxRatio(double val) {m_Ratio = val;}
-    void setVehicleMass(double val) {m_Mass = val;}
+    void setVehicleMass(double val) {m_Mass = val; updateGradientForce();}
     void setLq(double val) {m_Lq = val;}
     void setLd(double val) {m_Ld = val;}
     void setRs(double val) {m_Rs = val;}
     void setPoles(double val) {m_Poles = val;}
     void setFluxLinkage(double val) {m_FluxLink = val;}
+    void setSaturationMaps(const param_table &Ld, const param_table &Lq, const param_table &fluxLink); //Ld(Id), Lq(Iq), λ(Iq)
+    void clearSaturationMaps(void) {m_Saturation = false;}
+    bool hasSaturationMaps(void) const {return m_Saturation;}
     void setSyncDelay(double val) {m_syncdelay = val;}
     void setTimestep(double val) {m_Timestep = val;}
     void setPosition(double val) {m_Position = (val * m_Poles);}
     void setSamplingPoint(double val) {m_samplingPoint = val;}
-    void setRoadGradient(double val) {m_RoadGradient = val;}
+    void setRoadGradient(double val) {m_RoadGradient = val; updateGradientForce();}
+    double getWheelSize(void) {return m_WheelSize;}
+    double getGboxRatio(void) {return m_Ratio;}
+    double getVehicleMass(void) {return m_Mass;}
+    double getRoadGradient(void) {return m_RoadGradient;}
+    double getTimestep(void) {return m_Timestep;}
+    double getLq(void) {return m_Lq;}
+    double getLd(void) {return m_Ld;}
+    double getRs(void) {return m_Rs;}
+    double getPoles(void) {return m_Poles;}
+    double getFluxLinkage(void) {return m_FluxLink;}
     double getMotorPosition(void);
     double getElecPosition(void);
     double getMotorFreq(void) {return m_Frequency;}
@@ -63,10 +107,16 @@ public:
 
 
 private:
+    void updateGradientForce(void) {m_GradientForce = -(qSin(qAtan(m_RoadGradient))*m_Mass*9.81);}
+    template<class Outputs> void updateVehicle(double dt, double Lq, double Ld, double fluxLink);
+    void currentParams(double Iq, double Id, double *Lq, double *Ld, double *fluxLink) const;
+    void currentDerivative(double Vq, double Vd, double w, double Iq, double Id, double *dIq, double *dId);
+
     double m_WheelSize;
     double m_Ratio;
     double m_RoadGradient;
     double m_Mass;
+    double m_GradientForce; //only changes with gradient or mass so not recalculated every step
     double m_Lq;
     double m_Ld;
     double m_Rs;
@@ -74,6 +124,8 @@ private:
     double m_FluxLink; //Hz
     double m_syncdelay;
     double m_samplingPoint; //sampling position as fraction of period, 0=start, 1=end
+    bool m_Saturation; //use the maps below in place of m_Ld, m_Lq and m_FluxLink
+    param_table m_LdMap, m_LqMap, m_FluxLinkMap;
 
     double m_Position; //degrees
     double m_Frequency; // Hz motor speed (NOT electrical)
@@ -92,6 +144,10 @@ private:
     double m_Vd_dueto_Rd;
     double m_VLd;
     double m_VLq;
+
+    double m_DynamicTol; //StepDynamic relative error per step
+    double m_DynamicStep; //last StepDynamic step size (s)
+    quint64 m_DynamicSteps; //accepted StepDynamic steps since Restart
 };
 
 #endif // MOTORMODEL_H
@@ -0,0 +1,977 @@
+/*
+ * This file is part of the IPMMotorCalc project
+ *
+ * Copyright (C) 2023 Pete9008 <openinverter.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "motortuner.h"
+#include "replaykernel.h"
+#include "perfstats.h"
+#include <QtMath>
+#include <QtConcurrent>
+#include <QMap>
+#include <QElapsedTimer>
+#include <QAtomicInt>
+#include <limits>
+#include <cstring>
+#include <algorithm>
+
+MotorTuner::MotorTuner(const LogData *data)
+    :m_data{data}, m_window(data->window(std::numeric_limits<double>::lowest(), std::numeric_limits<double>::max())),
+     m_adaptive{false}, m_searchTol{0.0001}, m_monitor{nullptr}, m_index{nullptr}
+{
+}
+
+void MotorTuner::setWindow(double xmin, double xmax)
+{
+    m_window = m_data->window(1000*xmin, 1000*xmax);
+}
+
+void MotorTuner::setWindowRows(int begin, int end)
+{
+    m_window = m_data->window(std::numeric_limits<double>::lowest(), std::numeric_limits<double>::max());
+    m_window.begin = qBound(0, begin, m_window.end);
+    m_window.end = qBound(m_window.begin, end, m_window.end);
+}
+
+//Each call starts from a restarted model so replays are independent of each other, the model is stepped at 1ms
+//from the first row inside the window and compared against the log at the end of each row. Cost is per row rather
+//than per ms of log, see below.
+replay_error MotorTuner::replay(MotorModel &motor, replay_trace *trace) const
+{
+    replay_cursor cursor = {false, 0};
+    motor.Restart();
+    return resumeReplay(motor, &cursor, trace);
+}
+
+//replay() carrying on from the model and cursor left by the last call rather than restarting
+replay_error MotorTuner::resumeReplay(MotorModel &motor, replay_cursor *cursor, replay_trace *trace) const
+{
+    PERF_SCOPE("tuner.replay");
+    replay_error err = {0, 0, 0, 0, 0};
+    bool started = cursor->started;
+    qint64 timenow = cursor->timenow;
+    qint64 modelSteps = 0; //counted here rather than in StepOutputs to keep the counter out of the loop
+
+    const qint64 *time = m_data->times();
+    const double *id = m_data->channel(chan_id);
+    const double *iq = m_data->channel(chan_iq);
+    const double *ud = m_data->channel(chan_ud);
+    const double *uq = m_data->channel(chan_uq);
+    const double *frq = m_data->channel(chan_frq);
+
+    for(int i=m_window.begin; i<m_window.end; i++)
+    {
+        if(m_window.contains(time[i]))
+        {
+            if(!started)
+            {
+                timenow = time[i];
+                started = true;
+            }
+            //With the speed forced from the log before every step the voltages only depend on the previous step's
+            //frequency, so after the first step of a row every further 1ms step gives the same result. Two steps
+            //therefore give the same voltages as stepping all the way to the next row, however far away it is.
+            qint64 steps = qMax((qint64)1, time[i+1] - timenow);
+            for(qint64 step=0; step<qMin(steps, (qint64)2); step++)
+            {
+                motor.setSpeedFromElecFreq(frq[i]);//prevent cumulative drift
+                motor.StepOutputs<VoltageOutputs>(iq[i], id[i]);
+            }
+            timenow += steps;
+            modelSteps += qMin(steps, (qint64)2);
+
+            double error_vq = motor.getVq() - uq[i];
+            double error_vd = motor.getVd() - ud[i];
+            err.vd += qFabs(error_vd);
+            err.vq += qFabs(error_vq);
+            err.rows++;
+
+            if(trace)
+            {
+                double error_frq = motor.getElecFreq() - frq[i+1];
+                double secTime = timenow/1000.0;
+                trace->errVd.append(QPointF(secTime, error_vd));
+                trace->errVq.append(QPointF(secTime, error_vq));
+                trace->errFrq.append(QPointF(secTime, error_frq));
+                trace->vd.append(QPointF(secTime, motor.getVd()));
+                trace->vq.append(QPointF(secTime, motor.getVq()));
+                trace->frq.append(QPointF(secTime, motor.getElecFreq()));
+            }
+        }
+    }
+    cursor->started = started;
+    cursor->timenow = timenow;
+    PERF_COUNT("tuner.replayRows", err.rows);
+    PERF_COUNT("model.steps", modelSteps);
+    return err;
+}
+
+//Dynamic model replay, the logged voltages are applied to the model for the time to the next row and the resulting
+//currents compared with the next row's logged currents. Currents start from the first row in the window. The errors are
+//infinite if StepDynamic fails part way through.
+replay_error MotorTuner::replayDynamic(MotorModel &motor, replay_trace *trace) const
+{
+    replay_cursor cursor = {false, 0};
+    motor.Restart();
+    return resumeReplayDynamic(motor, &cursor, trace);
+}
+
+//replayDynamic() carrying on from the currents left by the last call rather than the window's first row
+replay_error MotorTuner::resumeReplayDynamic(MotorModel &motor, replay_cursor *cursor, replay_trace *trace) const
+{
+    PERF_SCOPE("tuner.replayDynamic");
+    replay_error err = {0, 0, 0, 0, 0};
+    bool started = cursor->started;
+    quint64 firstStep = motor.getDynamicSteps();
+
+    const qint64 *time = m_data->times();
+    const double *id = m_data->channel(chan_id);
+    const double *iq = m_data->channel(chan_iq);
+    const double *ud = m_data->channel(chan_ud);
+    const double *uq = m_data->channel(chan_uq);
+    const double *frq = m_data->channel(chan_frq);
+
+    for(int i=m_window.begin; i<m_window.end; i++)
+    {
+        if(((i & 0xfff) == 0) && isCancelled())
+            break;
+        if(m_window.contains(time[i]))
+        {
+            if(!started)
+            {
+                motor.setCurrents(iq[i], id[i]);
+                started = true;
+            }
+            motor.setSpeedFromElecFreq(frq[i]);//prevent cumulative drift
+            if(!motor.StepDynamic(uq[i], ud[i], (time[i+1] - time[i])/1000.0))
+            {   //parameters the model can't integrate, rank them behind every candidate that can
+                err.id = std::numeric_limits<double>::infinity();
+                err.iq = std::numeric_limits<double>::infinity();
+                started = false; //a resumed replay picks the currents up from the log again
+                break;
+            }
+
+            double error_id = motor.getId() - id[i+1];
+            double error_iq = motor.getIq() - iq[i+1];
+            err.id += qFabs(error_id);
+            err.iq += qFabs(error_iq);
+            err.rows++;
+
+            if(trace)
+            {
+                double secTime = time[i+1]/1000.0;
+                trace->errId.append(QPointF(secTime, error_id));
+                trace->errIq.append(QPointF(secTime, error_iq));
+                trace->errFrq.append(QPointF(secTime, motor.getElecFreq() - frq[i+1]));
+                trace->id.append(QPointF(secTime, motor.getId()));
+                trace->iq.append(QPointF(secTime, motor.getIq()));
+                trace->frq.append(QPointF(secTime, motor.getElecFreq()));
+            }
+        }
+    }
+    cursor->started = started;
+    PERF_COUNT("model.dynamicSteps", motor.getDynamicSteps() - firstStep);
+    return err;
+}
+
+//Lq only affects Vd, Ld and flux linkage only affect Vq, Rs affects both
+double MotorTuner::tuneError(tuneParam param, const replay_error &err)
+{
+    switch(param)
+    {
+    case tune_Lq:
+        return err.vd;
+    case tune_Rs:
+        return (err.vd + err.vq)/2.0;
+    case tune_Ld:
+    case tune_FL:
+    default:
+        return err.vq;
+    }
+}
+
+double MotorTuner::getParam(MotorModel &motor, tuneParam param)
+{
+    switch(param)
+    {
+    case tune_Lq:
+        return motor.getLq();
+    case tune_Ld:
+        return motor.getLd();
+    case tune_Rs:
+        return motor.getRs();
+    case tune_FL:
+    default:
+        return motor.getFluxLinkage();
+    }
+}
+
+void MotorTuner::setParam(MotorModel &motor, tuneParam param, double val)
+{
+    switch(param)
+    {
+    case tune_Lq:
+        motor.setLq(val);
+        break;
+    case tune_Ld:
+        motor.setLd(val);
+        break;
+    case tune_Rs:
+        motor.setRs(val);
+        break;
+    case tune_FL:
+    default:
+        motor.setFluxLinkage(val);
+        break;
+    }
+}
+
+//Replays the candidate values REPLAY_BATCH at a time through the SIMD kernel, with the batches spread across the
+//global thread pool. Errors are returned in the same order as the candidates so the result doesn't depend on thread
+//scheduling, and match replay() (see ReplayKernel for the tolerance).
+QVector<double> MotorTuner::evaluate(const MotorModel &motor, tuneParam param, const QVector<double> &candidates) const
+{
+    PERF_SCOPE("tuner.evaluate");
+    PERF_COUNT("tuner.candidates", candidates.size());
+    if(motor.hasSaturationMaps()) //the kernel only knows fixed parameters
+        return evaluateScalar(motor, param, candidates);
+
+    QVector<double> errors(candidates.size());
+    QVector<replay_batch> batches((candidates.size() + REPLAY_BATCH - 1) / REPLAY_BATCH);
+    MotorModel model(motor);
+    for(int b=0; b<batches.size(); b++)
+    {
+        for(int lane=0; lane<REPLAY_BATCH; lane++)
+        {   //pad a part filled batch by repeating its last candidate
+            setParam(model, param, candidates[qMin((b * REPLAY_BATCH) + lane, candidates.size() - 1)]);
+            batches[b].Rs[lane] = model.getRs();
+            batches[b].Ld[lane] = model.getLd();
+            batches[b].Lq[lane] = model.getLq();
+            batches[b].fluxLink[lane] = model.getFluxLinkage();
+            batches[b].errVd[lane] = std::numeric_limits<double>::infinity(); //left like this if cancelled
+            batches[b].errVq[lane] = std::numeric_limits<double>::infinity();
+        }
+        batches[b].rows = 0;
+        batches[b].steps = 0;
+    }
+
+    QAtomicInt done(0);
+    const replay_batch *first = batches.constData();
+    QtConcurrent::blockingMap(batches, [&](replay_batch &batch)
+    {
+        if(isCancelled())
+            return;
+        MotorModel local(motor);
+        ReplayKernel::run(m_data, m_window, local, &batch);
+        PERF_COUNT("kernel.rows", batch.rows);
+        PERF_COUNT("model.steps", (qint64)batch.steps * REPLAY_BATCH);
+        if(m_monitor)
+        {
+            int start = (&batch - first) * REPLAY_BATCH;
+            for(int lane=0; (lane<REPLAY_BATCH) && ((start + lane) < candidates.size()); lane++)
+            {
+                replay_error err = {batch.errVd[lane], batch.errVq[lane], batch.rows, 0, 0};
+                m_monitor->candidate(param, candidates[start + lane], tuneError(param, err));
+            }
+            m_monitor->progress(done.fetchAndAddOrdered(1) + 1, batches.size());
+        }
+    });
+
+    for(int i=0; i<candidates.size(); i++)
+    {
+        const replay_batch &batch = batches[i / REPLAY_BATCH];
+        replay_error err = {batch.errVd[i % REPLAY_BATCH], batch.errVq[i % REPLAY_BATCH], batch.rows, 0, 0};
+        errors[i] = tuneError(param, err);
+    }
+    return errors;
+}
+
+//As evaluate but one replay() per candidate, for models the kernel can't run
+QVector<double> MotorTuner::evaluateScalar(const MotorModel &motor, tuneParam param, const QVector<double> &candidates) const
+{
+    PERF_SCOPE("tuner.evaluateScalar");
+    QVector<double> errors(candidates.size(), std::numeric_limits<double>::infinity()); //left like this if cancelled
+    QVector<int> index(candidates.size());
+    for(int i=0; i<index.size(); i++)
+        index[i] = i;
+
+    QAtomicInt done(0);
+    QtConcurrent::blockingMap(index, [&](int i)
+    {
+        if(isCancelled())
+            return;
+        MotorModel local(motor);
+        setParam(local, param, candidates[i]);
+        errors[i] = tuneError(param, replay(local));
+        if(m_monitor)
+        {
+            m_monitor->candidate(param, candidates[i], errors[i]);
+            m_monitor->progress(done.fetchAndAddOrdered(1) + 1, index.size());
+        }
+    });
+    return errors;
+}
+
+//Sweeps +/-deltaPercent around the current model value in 201 steps, the passed model is left untouched
+sweep_result MotorTuner::sweep(const MotorModel &motor, tuneParam param, double deltaPercent) const
+{
+    sweep_result result;
+    MotorModel model(motor);
+    double centre = getParam(model, param);
+    result.minError = std::numeric_limits<double>::max();
+    result.best = centre; //kept if cancelled before anything is evaluated
+    double scale = deltaPercent/10000.0;
+    QVector<double> candidates;
+    for(int percent=-100;percent<=100;percent++)
+        candidates.append(centre + (centre * ((percent * scale))));
+
+    QVector<double> errors = evaluate(motor, param, candidates);
+    result.evaluations = candidates.size();
+    for(int i=0; i<candidates.size(); i++)
+    {
+        result.errorCurve.append(QPointF(candidates[i]*1000, errors[i]));
+        if(errors[i] < result.minError) //strict so ties go to the lowest candidate, same as the serial sweep
+        {
+            result.minError = errors[i];
+            result.best = candidates[i];
+        }
+    }
+    return result;
+}
+
+//Golden section search over the same +/-deltaPercent range as sweep(), stopping once the bracket is smaller than
+//m_searchTol of the starting value. This assumes the error has a single minimum over the range. That usually holds as
+//the voltages are close to linear in the parameter being tuned, but not exactly: the first step of each row uses a
+//frequency advanced by the acceleration from torque, which depends on Ld, Lq and flux linkage. A wide range on a
+//noisy log can have more than one dip and the bracket may then settle on the wrong one, sweep() doesn't have that risk.
+sweep_result MotorTuner::search(const MotorModel &motor, tuneParam param, double deltaPercent) const
+{
+    const double invPhi = (qSqrt(5.0) - 1.0)/2.0;
+    sweep_result result;
+    QMap<double, double> visited; //keeps the error curve sorted by parameter value
+
+    MotorModel model(motor);
+    double centre = getParam(model, param);
+    double lo = centre - qFabs(centre * deltaPercent/100.0);
+    double hi = centre + qFabs(centre * deltaPercent/100.0);
+    double tol = qMax(qFabs(centre * m_searchTol), std::numeric_limits<double>::min());
+
+    //every iteration shrinks the bracket by invPhi, for the progress estimate
+    int expected = 4 + qMax(0, qCeil(qLn(tol/(hi - lo))/qLn(invPhi)));
+    auto error = [&](double val)
+    {
+        setParam(model, param, val);
+        double err = tuneError(param, replay(model));
+        visited.insert(val, err);
+        if(m_monitor)
+        {
+            m_monitor->candidate(param, val, err);
+            m_monitor->progress(visited.size(), qMax(expected, visited.size()));
+        }
+        return err;
+    };
+
+    //evaluate the ends too so the curve covers the full range and an edge minimum is found
+    error(lo);
+    error(hi);
+    double x1 = hi - invPhi * (hi - lo);
+    double x2 = lo + invPhi * (hi - lo);
+    double f1 = error(x1);
+    double f2 = error(x2);
+    while(((hi - lo) > tol) && !isCancelled())
+    {
+        if(f1 < f2)
+        {
+            hi = x2;
+            x2 = x1;
+            f2 = f1;
+            x1 = hi - invPhi * (hi - lo);
+            f1 = error(x1);
+        }
+        else
+        {
+            lo = x1;
+            x1 = x2;
+            f1 = f2;
+            x2 = lo + invPhi * (hi - lo);
+            f2 = error(x2);
+        }
+    }
+
+    result.minError = std::numeric_limits<double>::max();
+    result.best = 0;
+    for(auto i = visited.constBegin(); i != visited.constEnd(); ++i)
+    {
+        result.errorCurve.append(QPointF(i.key()*1000, i.value()));
+        if(i.value() < result.minError)
+        {
+            result.minError = i.value();
+            result.best = i.key();
+        }
+    }
+    result.evaluations = visited.size();
+    return result;
+}
+
+sweep_result MotorTuner::tune(const MotorModel &motor, tuneParam param, double deltaPercent) const
+{
+    if(m_adaptive)
+        return search(motor, param, deltaPercent);
+    return sweep(motor, param, deltaPercent);
+}
+
+//Sums for the window, two lookups with an index covering it or one pass over the rows without
+voltage_sums MotorTuner::windowSums(void) const
+{
+    if(m_index && m_index->covers(m_data, m_window))
+        return m_index->sums(m_window.begin, m_window.end);
+
+    const qint64 *time = m_data->times();
+    const double *id = m_data->channel(chan_id);
+    const double *iq = m_data->channel(chan_iq);
+    const double *ud = m_data->channel(chan_ud);
+    const double *uq = m_data->channel(chan_uq);
+    const double *frq = m_data->channel(chan_frq);
+
+    voltage_sums sums;
+    memset(&sums, 0, sizeof(sums));
+    for(int i=m_window.begin; i<m_window.end; i++)
+        if(m_window.contains(time[i]))
+            sums.add(id[i], iq[i], ud[i], uq[i], frq[i]);
+    return sums;
+}
+
+//sweep() over the same candidates but against the steady state voltage equations (as leastSquares) rather than a
+//replay, so with an ErrorIndex the whole curve costs the same for any window. Errors are the rms error in volts of the
+//equations the parameter appears in, Vd for Lq, Vq for Ld and λ, both for Rs. The squared error is a quadratic in the
+//parameter so best is its exact minimum within the range rather than the best candidate.
+sweep_result MotorTuner::quickSweep(const MotorModel &motor, tuneParam param, double deltaPercent) const
+{
+    PERF_SCOPE("tuner.quickSweep");
+    sweep_result result;
+    MotorModel model(motor);
+    double centre = getParam(model, param);
+    result.minError = std::numeric_limits<double>::max();
+    result.best = centre;
+    result.evaluations = 0;
+
+    const voltage_sums sums = windowSums();
+    if(!sums.rows)
+        return result;
+    const double Rs = model.getRs(), Ld = model.getLd(), Lq = model.getLq(), fluxLink = model.getFluxLinkage();
+    auto squaredError = [&](double val)
+    {
+        switch(param)
+        {
+        case tune_Lq:
+            return sums.errorVd(Rs, val);
+        case tune_Ld:
+            return sums.errorVq(Rs, val, fluxLink);
+        case tune_Rs:
+            return (sums.errorVd(val, Lq) + sums.errorVq(val, Ld, fluxLink))/2.0;
+        case tune_FL:
+        default:
+            return sums.errorVq(Rs, Ld, val);
+        }
+    };
+
+    double scale = deltaPercent/10000.0;
+    for(int percent=-100;percent<=100;percent++)
+    {
+        double candidate = centre + (centre * ((percent * scale)));
+        result.errorCurve.append(QPointF(candidate*1000, qSqrt(squaredError(candidate)/sums.rows)));
+    }
+    result.evaluations = result.errorCurve.size();
+
+    //fit the quadratic through the centre and range ends, its minimum clamped to the range
+    double half = qFabs(centre * scale * 100);
+    double lower = centre - half, upper = centre + half;
+    double best = centre;
+    if(half > 0)
+    {
+        double e0 = squaredError(lower), e1 = squaredError(centre), e2 = squaredError(upper);
+        double curvature = e0 + e2 - (2 * e1);
+        if(curvature > 0)
+            best = qBound(lower, centre - ((half * (e2 - e0)) / (2 * curvature)), upper);
+        else
+            best = (e0 < e2) ? lower : upper;
+    }
+    result.best = best;
+    result.minError = qSqrt(squaredError(best)/sums.rows);
+    return result;
+}
+
+//run each tune several times, FL first as it impacts on the others more than they impact on it
+void MotorTuner::autoTune(MotorModel &motor, double deltaFL, double deltaLd, double deltaLq, int passes) const
+{
+    for(int i=0;(i<passes) && !isCancelled();i++)
+    {
+        motor.setFluxLinkage(tune(motor, tune_FL, deltaFL).best);
+        motor.setLd(tune(motor, tune_Ld, deltaLd).best);
+        motor.setLq(tune(motor, tune_Lq, deltaLq).best);
+    }
+}
+
+//Nelder-Mead simplex over (Rs, Ld, Lq, λ) together using the full replay as the objective, so coupled parameters
+//(Ld and λ both act through Vq) move together instead of one at a time. Parameters are searched as a ratio to the
+//starting value to keep the simplex well scaled, the initial simplex steps each one by stepPercent.
+//Stops when the simplex has shrunk to tolerance in both parameter ratio and relative error.
+//With fitRs false Rs is held at the model's value (it should come from a locked shaft log) and only Ld, Lq and λ move.
+joint_result MotorTuner::jointTune(MotorModel &motor, double stepPercent, double tolerance, int maxIterations, bool fitRs) const
+{
+    PERF_SCOPE("tuner.jointTune");
+    const int maxN = 4;
+    const tuneParam allParams[maxN] = {tune_Rs, tune_Ld, tune_Lq, tune_FL};
+    const int n = fitRs ? maxN : maxN - 1;
+    const tuneParam *params = fitRs ? allParams : allParams + 1;
+    joint_result result;
+    result.converged = false;
+    result.iterations = 0;
+    result.evaluations = 0;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    double start[maxN];
+    for(int j=0; j<n; j++)
+        start[j] = getParam(motor, params[j]);
+
+    MotorModel model(motor);
+    auto error = [&](const double *x)
+    {
+        for(int j=0; j<n; j++)
+            setParam(model, params[j], start[j] * x[j]);
+        replay_error err = replay(model);
+        result.evaluations++;
+        return err.vd + err.vq;
+    };
+
+    double simplex[maxN+1][maxN];
+    double f[maxN+1];
+    for(int i=0; i<=n; i++)
+    {
+        for(int j=0; j<n; j++)
+            simplex[i][j] = 1.0;
+        if(i > 0)
+            simplex[i][i-1] += stepPercent/100.0;
+        f[i] = error(simplex[i]);
+    }
+
+    while(result.iterations < maxIterations)
+    {
+        //order best to worst
+        for(int i=1; i<=n; i++)
+        {
+            for(int k=i; (k>0) && (f[k] < f[k-1]); k--)
+            {
+                std::swap(f[k], f[k-1]);
+                for(int j=0; j<n; j++)
+                    std::swap(simplex[k][j], simplex[k-1][j]);
+            }
+        }
+
+        double size = 0;
+        for(int i=1; i<=n; i++)
+            for(int j=0; j<n; j++)
+                size = qMax(size, qFabs(simplex[i][j] - simplex[0][j]));
+        if((size <= tolerance) && ((f[n] - f[0]) <= (tolerance * qFabs(f[0]))))
+        {
+            result.converged = true;
+            break;
+        }
+        if(isCancelled())
+            break;
+        result.iterations++;
+        if(m_monitor)
+            m_monitor->progress(result.iterations, maxIterations);
+
+        double centroid[maxN] = {};
+        for(int i=0; i<n; i++)
+            for(int j=0; j<n; j++)
+                centroid[j] += simplex[i][j]/n;
+
+        double xr[maxN], xe[maxN], xc[maxN];
+        for(int j=0; j<n; j++)
+            xr[j] = centroid[j] + (centroid[j] - simplex[n][j]);
+        double fr = error(xr);
+        if(fr < f[0])
+        {
+            for(int j=0; j<n; j++)
+                xe[j] = centroid[j] + 2.0 * (centroid[j] - simplex[n][j]);
+            double fe = error(xe);
+            const double *xnew = (fe < fr) ? xe : xr;
+            for(int j=0; j<n; j++)
+                simplex[n][j] = xnew[j];
+            f[n] = qMin(fe, fr);
+        }
+        else if(fr < f[n-1])
+        {
+            for(int j=0; j<n; j++)
+                simplex[n][j] = xr[j];
+            f[n] = fr;
+        }
+        else
+        {
+            bool outside = (fr < f[n]);
+            for(int j=0; j<n; j++)
+                xc[j] = outside ? centroid[j] + 0.5 * (xr[j] - centroid[j]) : centroid[j] + 0.5 * (simplex[n][j] - centroid[j]);
+            double fc = error(xc);
+            if(fc < (outside ? fr : f[n]))
+            {
+                for(int j=0; j<n; j++)
+                    simplex[n][j] = xc[j];
+                f[n] = fc;
+            }
+            else
+            {   //shrink towards the best point
+                for(int i=1; i<=n; i++)
+                {
+                    for(int j=0; j<n; j++)
+                        simplex[i][j] = simplex[0][j] + 0.5 * (simplex[i][j] - simplex[0][j]);
+                    f[i] = error(simplex[i]);
+                }
+            }
+        }
+    }
+
+    int best = 0;
+    for(int i=1; i<=n; i++)
+        if(f[i] < f[best])
+            best = i;
+    for(int j=0; j<n; j++)
+        setParam(motor, params[j], start[j] * simplex[best][j]);
+    result.error = f[best];
+    result.elapsedMs = timer.elapsed();
+    return result;
+}
+
+//Solves the n x n normal equations A (row major) x = b in place with partial pivoting, returns false if singular
+static bool solveNormal(double *A, double *b, double *x, int n)
+{
+    //scale to unit diagonal first, the columns differ by several orders of magnitude (Id vs w*Iq)
+    QVector<double> scale(n);
+    for(int i=0; i<n; i++)
+    {
+        if(A[(i * n) + i] <= 0)
+            return false;
+        scale[i] = 1.0/qSqrt(A[(i * n) + i]);
+    }
+    for(int i=0; i<n; i++)
+    {
+        for(int j=0; j<n; j++)
+            A[(i * n) + j] *= scale[i] * scale[j];
+        b[i] *= scale[i];
+    }
+
+    for(int col=0; col<n; col++)
+    {
+        int pivot = col;
+        for(int r=col+1; r<n; r++)
+            if(qFabs(A[(r * n) + col]) > qFabs(A[(pivot * n) + col]))
+                pivot = r;
+        if(qFabs(A[(pivot * n) + col]) < 1e-9)
+            return false;
+        if(pivot != col)
+        {
+            for(int j=0; j<n; j++)
+                std::swap(A[(col * n) + j], A[(pivot * n) + j]);
+            std::swap(b[col], b[pivot]);
+        }
+        for(int r=col+1; r<n; r++)
+        {
+            double f = A[(r * n) + col]/A[(col * n) + col];
+            if(f == 0)
+                continue;
+            for(int j=col; j<n; j++)
+                A[(r * n) + j] -= f * A[(col * n) + j];
+            b[r] -= f * b[col];
+        }
+    }
+    for(int i=n-1; i>=0; i--)
+    {
+        double sum = b[i];
+        for(int j=i+1; j<n; j++)
+            sum -= A[(i * n) + j] * x[j];
+        x[i] = sum/A[(i * n) + i];
+    }
+    for(int i=0; i<n; i++)
+        x[i] *= scale[i];
+    return true;
+}
+
+//Direct fit of the steady state voltage equations used by MotorModel::Step
+//  Vd = Rs*Id - w*Lq*Iq
+//  Vq = Rs*Iq + w*Ld*Id + w*λ
+//with w the electrical speed in rad/s taken from fstat. Both are linear in x = [Rs, Ld, Lq, λ] so every row in the window adds two
+//equations to a single least squares problem, solved from its normal equations.
+lsq_result MotorTuner::leastSquares(void) const
+{
+    PERF_SCOPE("tuner.leastSquares");
+    lsq_result result;
+    result.valid = false;
+    result.Rs = result.Ld = result.Lq = result.fluxLink = 0;
+    result.rows = 0;
+    result.rmsVd = result.rmsVq = 0;
+
+    const qint64 *time = m_data->times();
+    const double *id = m_data->channel(chan_id);
+    const double *iq = m_data->channel(chan_iq);
+    const double *ud = m_data->channel(chan_ud);
+    const double *uq = m_data->channel(chan_uq);
+    const double *frq = m_data->channel(chan_frq);
+
+    double A[4][4] = {};
+    double b[4] = {};
+    for(int i=m_window.begin; i<m_window.end; i++)
+    {
+        if(m_window.contains(time[i]))
+        {
+            double w = 2 * M_PI * frq[i];
+            const double d[4] = {id[i], 0, -w * iq[i], 0};
+            const double q[4] = {iq[i], w * id[i], 0, w};
+            for(int r=0; r<4; r++)
+            {
+                for(int c=0; c<4; c++)
+                    A[r][c] += (d[r] * d[c]) + (q[r] * q[c]);
+                b[r] += (d[r] * ud[i]) + (q[r] * uq[i]);
+            }
+            result.rows++;
+        }
+    }
+
+    double x[4];
+    if(!result.rows || !solveNormal(&A[0][0], b, x, 4))
+        return result;
+
+    result.valid = true;
+    result.Rs = x[0];
+    result.Ld = x[1];
+    result.Lq = x[2];
+    result.fluxLink = x[3];
+
+    double sumVd = 0, sumVq = 0;
+    for(int i=m_window.begin; i<m_window.end; i++)
+    {
+        if(m_window.contains(time[i]))
+        {
+            double w = 2 * M_PI * frq[i];
+            double resVd = (result.Rs * id[i]) - (w * result.Lq * iq[i]) - ud[i];
+            double resVq = (result.Rs * iq[i]) + (w * result.Ld * id[i]) + (w * result.fluxLink) - uq[i];
+            sumVd += resVd * resVd;
+            sumVq += resVq * resVq;
+            double secTime = time[i]/1000.0;
+            result.resVd.append(QPointF(secTime, resVd));
+            result.resVq.append(QPointF(secTime, resVq));
+        }
+    }
+    result.rmsVd = qSqrt(sumVd/result.rows);
+    result.rmsVq = qSqrt(sumVq/result.rows);
+    return result;
+}
+
+//Sufficient statistics of the leastSquares normal equations for the rows in one (Id, Iq) bin, over the unknowns
+//[Rs, Ld, Lq, λ] local to the bin
+struct saturation_bin {
+    double A[4][4];
+    double b[4];
+    double yy; //sum of ud^2 + uq^2
+    int rows;
+};
+
+//leastSquares with Ld a table against Id and Lq, λ tables against Iq (Rs stays a single value). One pass over the window
+//sorts every row into an (Id, Iq) bin and adds it to that bin's normal equations, everything after that (assembling
+//the tables' normal equations, solving, the residual) only depends on the number of bins. A first difference penalty
+//between neighbouring table points, smoothing times the mean diagonal of that table, keeps the tables smooth and fills
+//points no row landed near from their neighbours.
+saturation_result MotorTuner::fitSaturation(int idBins, int iqBins, double smoothing) const
+{
+    PERF_SCOPE("tuner.fitSaturation");
+    saturation_result result;
+    result.valid = false;
+    result.Rs = 0;
+    result.rows = 0;
+    result.usedBins = 0;
+    result.rms = 0;
+
+    const qint64 *time = m_data->times();
+    const double *id = m_data->channel(chan_id);
+    const double *iq = m_data->channel(chan_iq);
+    const double *ud = m_data->channel(chan_ud);
+    const double *uq = m_data->channel(chan_uq);
+    const double *frq = m_data->channel(chan_frq);
+
+    if((idBins < 1) || (iqBins < 1))
+        return result;
+
+    double idMin = std::numeric_limits<double>::max(), idMax = -idMin;
+    double iqMin = idMin, iqMax = -idMin;
+    for(int i=m_window.begin; i<m_window.end; i++)
+    {
+        if(m_window.contains(time[i]))
+        {
+            idMin = qMin(idMin, id[i]);
+            idMax = qMax(idMax, id[i]);
+            iqMin = qMin(iqMin, iq[i]);
+            iqMax = qMax(iqMax, iq[i]);
+        }
+    }
+    if(idMin > idMax)
+        return result;
+    double idStep = qMax((idMax - idMin) / idBins, 1e-6);
+    double iqStep = qMax((iqMax - iqMin) / iqBins, 1e-6);
+
+    QVector<saturation_bin> bins(idBins * iqBins);
+    memset(bins.data(), 0, bins.size() * sizeof(saturation_bin));
+    for(int i=m_window.begin; i<m_window.end; i++)
+    {
+        if(m_window.contains(time[i]))
+        {
+            int binId = qBound(0, (int)((id[i] - idMin) / idStep), idBins - 1);
+            int binIq = qBound(0, (int)((iq[i] - iqMin) / iqStep), iqBins - 1);
+            saturation_bin &bin = bins[(binIq * idBins) + binId];
+            double w = 2 * M_PI * frq[i];
+            const double d[4] = {id[i], 0, -w * iq[i], 0};
+            const double q[4] = {iq[i], w * id[i], 0, w};
+            for(int r=0; r<4; r++)
+            {
+                for(int c=0; c<4; c++)
+                    bin.A[r][c] += (d[r] * d[c]) + (q[r] * q[c]);
+                bin.b[r] += (d[r] * ud[i]) + (q[r] * uq[i]);
+            }
+            bin.yy += (ud[i] * ud[i]) + (uq[i] * uq[i]);
+            bin.rows++;
+        }
+    }
+
+    //unknowns are Rs, then the Ld, Lq and λ table points
+    const int n = 1 + idBins + (2 * iqBins);
+    const int firstLd = 1, firstLq = 1 + idBins, firstFL = 1 + idBins + iqBins;
+    QVector<double> A(n * n, 0), b(n, 0), x(n);
+    for(int binIq=0; binIq<iqBins; binIq++)
+    {
+        for(int binId=0; binId<idBins; binId++)
+        {
+            const saturation_bin &bin = bins[(binIq * idBins) + binId];
+            if(!bin.rows)
+                continue;
+            const int map[4] = {0, firstLd + binId, firstLq + binIq, firstFL + binIq};
+            for(int r=0; r<4; r++)
+            {
+                for(int c=0; c<4; c++)
+                    A[(map[r] * n) + map[c]] += bin.A[r][c];
+                b[map[r]] += bin.b[r];
+            }
+            result.rows += bin.rows;
+            result.usedBins++;
+        }
+    }
+
+    auto smooth = [&](int first, int count)
+    {
+        double diag = 0;
+        int used = 0;
+        for(int k=first; k<(first + count); k++)
+        {
+            if(A[(k * n) + k] > 0)
+            {
+                diag += A[(k * n) + k];
+                used++;
+            }
+        }
+        if(!used)
+            return false; //nothing excites this table at all
+        double mu = smoothing * (diag / used);
+        for(int k=first; k<(first + count - 1); k++)
+        {
+            A[(k * n) + k] += mu;
+            A[((k + 1) * n) + k + 1] += mu;
+            A[(k * n) + k + 1] -= mu;
+            A[((k + 1) * n) + k] -= mu;
+        }
+        return true;
+    };
+    if(!smooth(firstLd, idBins) || !smooth(firstLq, iqBins) || !smooth(firstFL, iqBins))
+        return result;
+    if(!solveNormal(A.data(), b.data(), x.data(), n))
+        return result;
+
+    result.valid = true;
+    result.Rs = x[0];
+    result.Ld.start = idMin + (idStep / 2);
+    result.Ld.step = idStep;
+    result.Ld.values = x.mid(firstLd, idBins);
+    result.Lq.start = iqMin + (iqStep / 2);
+    result.Lq.step = iqStep;
+    result.Lq.values = x.mid(firstLq, iqBins);
+    result.fluxLink.start = result.Lq.start;
+    result.fluxLink.step = iqStep;
+    result.fluxLink.values = x.mid(firstFL, iqBins);
+
+    //residual sum of squares per bin is yy - 2 u.b + u.A.u with u the bin's table points
+    double sum = 0;
+    for(int binIq=0; binIq<iqBins; binIq++)
+    {
+        for(int binId=0; binId<idBins; binId++)
+        {
+            const saturation_bin &bin = bins[(binIq * idBins) + binId];
+            if(!bin.rows)
+                continue;
+            const double u[4] = {x[0], x[firstLd + binId], x[firstLq + binIq], x[firstFL + binIq]};
+            double res = bin.yy;
+            for(int r=0; r<4; r++)
+            {
+                res -= 2 * u[r] * bin.b[r];
+                for(int c=0; c<4; c++)
+                    res += u[r] * bin.A[r][c] * u[c];
+            }
+            sum += res;
+        }
+    }
+    result.rms = qSqrt(qMax(0.0, sum) / (2 * result.rows));
+    return result;
+}
+
+//Feeds every row of the window to an online estimator, which carries on from wherever it was left so a live log can be
+//tracked a batch at a time
+void MotorTuner::track(RlsEstimator &rls, rls_trace *trace) const
+{
+    PERF_SCOPE("tuner.track");
+    const qint64 *time = m_data->times();
+    const double *id = m_data->channel(chan_id);
+    const double *iq = m_data->channel(chan_iq);
+    const double *ud = m_data->channel(chan_ud);
+    const double *uq = m_data->channel(chan_uq);
+    const double *frq = m_data->channel(chan_frq);
+
+    for(int i=m_window.begin; i<m_window.end; i++)
+    {
+        if(((i & 0xfff) == 0) && isCancelled())
+            break;
+        if(m_window.contains(time[i]))
+        {
+            rls.update(id[i], iq[i], ud[i], uq[i], frq[i]);
+            if(trace)
+            {
+                double secTime = time[i]/1000.0;
+                trace->Rs.append(QPointF(secTime, rls.getRs()*1000));
+                trace->Ld.append(QPointF(secTime, rls.getLd()*1000));
+                trace->Lq.append(QPointF(secTime, rls.getLq()*1000));
+                trace->fluxLink.append(QPointF(secTime, rls.getFluxLinkage()*1000));
+            }
+        }
+    }
+}
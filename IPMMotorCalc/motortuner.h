@@ -0,0 +1,146 @@
+/*
+ * This file is part of the IPMMotorCalc project
+ *
+ * Copyright (C) 2023 Pete9008 <openinverter.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MOTORTUNER_H
+#define MOTORTUNER_H
+
+#include <QList>
+#include <QVector>
+#include <QPointF>
+#include "logdata.h"
+#include "motormodel.h"
+#include "rlsestimator.h"
+#include "errorindex.h"
+
+enum tuneParam {tune_Lq, tune_Ld, tune_Rs, tune_FL};
+
+struct replay_error {
+    double vd; //sum of absolute Vd errors over the window
+    double vq; //sum of absolute Vq errors over the window
+    int rows;
+    double id; //sum of absolute Id errors, replayDynamic only
+    double iq; //sum of absolute Iq errors, replayDynamic only
+};
+
+struct replay_trace {
+    QList<QPointF> vd, vq, frq;
+    QList<QPointF> errVd, errVq, errFrq;
+    QList<QPointF> id, iq, errId, errIq; //replayDynamic only
+};
+
+//Where a replay got to, so a log that arrives in batches can be replayed batch by batch with the same result as
+//replaying it in one go. Start from {false, 0} with a restarted model.
+struct replay_cursor {
+    bool started; //first row replayed, the model's state carries on from here
+    qint64 timenow; //ms the model has been stepped to
+};
+
+struct sweep_result {
+    double best; //best fit value in SI units
+    double minError;
+    QList<QPointF> errorCurve; //x in mH/mOhm/mWb to match the UI fields
+    int evaluations;
+};
+
+struct lsq_result {
+    bool valid; //false if the window doesn't excite all four parameters (e.g. locked shaft)
+    double Rs, Ld, Lq, fluxLink;
+    int rows;
+    double rmsVd, rmsVq;
+    QList<QPointF> resVd, resVq; //residual against time (s)
+};
+
+struct saturation_result {
+    bool valid; //false if the window doesn't excite every table, as for lsq_result
+    double Rs;
+    param_table Ld; //against Id
+    param_table Lq, fluxLink; //against Iq
+    int rows;
+    int usedBins; //(Id, Iq) bins with at least one row
+    double rms; //of the Vd and Vq residuals together, with each bin at its nearest table points
+};
+
+struct rls_trace {
+    QList<QPointF> Rs, Ld, Lq, fluxLink; //against time (s), in mOhm/mH/mWb to match the UI fields
+};
+
+struct joint_result {
+    bool converged;
+    int iterations;
+    int evaluations;
+    qint64 elapsedMs;
+    double error; //sum of absolute Vd and Vq errors at the solution
+};
+
+//Hooks for following and stopping long tunes from another thread. Called from the thread pool, possibly from several
+//threads at once, so implementations have to be thread safe.
+class TuneMonitor
+{
+public:
+    virtual ~TuneMonitor() {}
+    virtual bool isCancelled(void) const = 0;
+    virtual void progress(int done, int total) = 0;
+    virtual void candidate(tuneParam param, double value, double error) = 0; //one point of a sweep/search error curve, value in SI
+};
+
+//Replays a log through the motor model and tunes the model parameters against it.
+//Holds no GUI state so the same code is used by the GUI and the command line tools.
+class MotorTuner
+{
+public:
+    MotorTuner(const LogData *data);
+    void setWindow(double xmin, double xmax); //seconds, as returned by DataGraph::queryXaxis
+    void setWindowRows(int begin, int end); //rows [begin, end) whatever their time, e.g. the rows a stream just added
+    void setAdaptiveSearch(bool adaptive) {m_adaptive = adaptive;}
+    void setSearchTolerance(double tol) {m_searchTol = tol;} //fraction of the starting value
+    void setMonitor(TuneMonitor *monitor) {m_monitor = monitor;}
+    void setIndex(const ErrorIndex *index) {m_index = index;} //used by quickSweep when it covers the window
+    bool isCancelled(void) const {return m_monitor && m_monitor->isCancelled();}
+    replay_error replay(MotorModel &motor, replay_trace *trace = nullptr) const;
+    replay_error replayDynamic(MotorModel &motor, replay_trace *trace = nullptr) const;
+    replay_error resumeReplay(MotorModel &motor, replay_cursor *cursor, replay_trace *trace = nullptr) const;
+    replay_error resumeReplayDynamic(MotorModel &motor, replay_cursor *cursor, replay_trace *trace = nullptr) const;
+    QVector<double> evaluate(const MotorModel &motor, tuneParam param, const QVector<double> &candidates) const;
+    sweep_result sweep(const MotorModel &motor, tuneParam param, double deltaPercent) const;
+    sweep_result search(const MotorModel &motor, tuneParam param, double deltaPercent) const;
+    sweep_result tune(const MotorModel &motor, tuneParam param, double deltaPercent) const;
+    sweep_result quickSweep(const MotorModel &motor, tuneParam param, double deltaPercent) const;
+    voltage_sums windowSums(void) const;
+    lsq_result leastSquares(void) const;
+    saturation_result fitSaturation(int idBins, int iqBins, double smoothing = 0.01) const;
+    void track(RlsEstimator &rls, rls_trace *trace = nullptr) const;
+    void autoTune(MotorModel &motor, double deltaFL, double deltaLd, double deltaLq, int passes = 4) const;
+    joint_result jointTune(MotorModel &motor, double stepPercent, double tolerance = 0.0001, int maxIterations = 1000, bool fitRs = true) const;
+
+    static double tuneError(tuneParam param, const replay_error &err);
+    static double getParam(MotorModel &motor, tuneParam param);
+    static void setParam(MotorModel &motor, tuneParam param, double val);
+
+private:
+    QVector<double> evaluateScalar(const MotorModel &motor, tuneParam param, const QVector<double> &candidates) const;
+
+    const LogData *m_data;
+    log_window m_window;
+    bool m_adaptive;
+    double m_searchTol;
+    TuneMonitor *m_monitor;
+    const ErrorIndex *m_index;
+};
+
+#endif // MOTORTUNER_H
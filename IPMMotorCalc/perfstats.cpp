@@ -0,0 +1,105 @@
+/*
+ * This file is part of the IPMMotorCalc project
+ *
+ * Copyright (C) 2023 Pete9008 <openinverter.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "perfstats.h"
+
+#ifdef IPM_PERFSTATS
+
+#include <QMutex>
+#include <QList>
+#include <QStringList>
+#include <QFile>
+#include <QJsonDocument>
+#include <cstring>
+#include <algorithm>
+
+//counters live until exit, PERF_SCOPE/PERF_COUNT hold pointers to them in statics
+static QMutex s_lock;
+static QList<perf_counter *> s_counters;
+
+perf_counter *PerfStats::counter(const char *name)
+{
+    QMutexLocker lock(&s_lock);
+    for(int i=0; i<s_counters.size(); i++)
+        if(strcmp(s_counters[i]->name, name) == 0)
+            return s_counters[i];
+    perf_counter *counter = new perf_counter;
+    counter->name = name;
+    counter->calls = 0;
+    counter->nsecs = 0;
+    counter->items = 0;
+    s_counters.append(counter);
+    return counter;
+}
+
+void PerfStats::reset(void)
+{
+    QMutexLocker lock(&s_lock);
+    for(int i=0; i<s_counters.size(); i++)
+    {
+        s_counters[i]->calls = 0;
+        s_counters[i]->nsecs = 0;
+        s_counters[i]->items = 0;
+    }
+}
+
+QJsonObject PerfStats::toJson(void)
+{
+    QMutexLocker lock(&s_lock);
+    QJsonObject obj;
+    for(int i=0; i<s_counters.size(); i++)
+    {
+        QJsonObject counter;
+        counter["calls"] = s_counters[i]->calls.load();
+        counter["ms"] = s_counters[i]->nsecs.load() / 1e6;
+        counter["items"] = s_counters[i]->items.load();
+        obj[s_counters[i]->name] = counter;
+    }
+    return obj;
+}
+
+bool PerfStats::dump(QString fileName)
+{
+    QFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly))
+        return false;
+    return file.write(QJsonDocument(toJson()).toJson(QJsonDocument::Indented)) >= 0;
+}
+
+//up to eight entries, timed phases by total time then counts, e.g. "log.load 120 ms (1) | tuner.replay 3200 ms (201) | model.steps 12M"
+QString PerfStats::summary(void)
+{
+    QMutexLocker lock(&s_lock);
+    QList<perf_counter *> timed = s_counters;
+    std::sort(timed.begin(), timed.end(), [](const perf_counter *a, const perf_counter *b)
+    {
+        return a->nsecs.load() > b->nsecs.load();
+    });
+    QStringList parts;
+    for(int i=0; (i<timed.size()) && (parts.size()<8); i++)
+    {
+        if(timed[i]->calls.load())
+            parts.append(QString("%1 %2 ms (%3)").arg(timed[i]->name).arg(timed[i]->nsecs.load() / 1000000).arg(timed[i]->calls.load()));
+        if(timed[i]->items.load())
+            parts.append(QString("%1 %2").arg(timed[i]->name).arg(timed[i]->items.load()));
+    }
+    return parts.join(" | ");
+}
+
+#endif // IPM_PERFSTATS
@@ -0,0 +1,87 @@
+/*
+ * This file is part of the IPMMotorCalc project
+ *
+ * Copyright (C) 2023 Pete9008 <openinverter.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PERFSTATS_H
+#define PERFSTATS_H
+
+//Phase timers and counters, built in with qmake CONFIG+=perfstats (which defines IPM_PERFSTATS). Without it the
+//macros expand to nothing and none of this is compiled.
+//  PERF_SCOPE("name") times the rest of the enclosing block and counts the call
+//  PERF_COUNT("name", n) adds n items to the counter
+//Each use looks its counter up once, after that a scope costs two clock reads and three relaxed atomic adds so it
+//belongs around phases and loops, not inside them. Counters are shared by every thread and never reset on their own.
+
+#ifdef IPM_PERFSTATS
+
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QString>
+#include <atomic>
+
+struct perf_counter {
+    const char *name;
+    std::atomic<qint64> calls;
+    std::atomic<qint64> nsecs; //total time inside PERF_SCOPE
+    std::atomic<qint64> items; //total from PERF_COUNT
+};
+
+class PerfStats
+{
+public:
+    static perf_counter *counter(const char *name); //the same counter for the same name, thread safe
+    static void reset(void);
+    static QJsonObject toJson(void);
+    static bool dump(QString fileName);
+    static QString summary(void); //one line for a status bar
+};
+
+class PerfTimer
+{
+public:
+    explicit PerfTimer(perf_counter *counter) : m_counter{counter} {m_timer.start();}
+    ~PerfTimer()
+    {
+        m_counter->nsecs.fetch_add(m_timer.nsecsElapsed(), std::memory_order_relaxed);
+        m_counter->calls.fetch_add(1, std::memory_order_relaxed);
+    }
+
+private:
+    perf_counter *m_counter;
+    QElapsedTimer m_timer;
+};
+
+#define PERF_CONCAT2(a, b) a##b
+#define PERF_CONCAT(a, b) PERF_CONCAT2(a, b)
+#define PERF_SCOPE(name) \
+    static perf_counter *PERF_CONCAT(perfCounter, __LINE__) = PerfStats::counter(name); \
+    PerfTimer PERF_CONCAT(perfTimer, __LINE__)(PERF_CONCAT(perfCounter, __LINE__))
+#define PERF_COUNT(name, n) \
+    do { \
+        static perf_counter *perfCounter = PerfStats::counter(name); \
+        perfCounter->items.fetch_add((n), std::memory_order_relaxed); \
+    } while(0)
+
+#else
+
+#define PERF_SCOPE(name)
+#define PERF_COUNT(name, n) do {(void)sizeof(n);} while(0) //n isn't evaluated, just keeps locals kept for it from warning
+
+#endif // IPM_PERFSTATS
+
+#endif // PERFSTATS_H
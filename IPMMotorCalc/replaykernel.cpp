@@ -0,0 +1,165 @@
+/*
+ * This file is part of the IPMMotorCalc project
+ *
+ * Copyright (C) 2023 Pete9008 <openinverter.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "replaykernel.h"
+#include <QtMath>
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#define KERNEL_ISA "AVX-512"
+struct vbatch { __m512d v; };
+static inline vbatch vset(double x) {vbatch r; r.v = _mm512_set1_pd(x); return r;}
+static inline vbatch vload(const double *p) {vbatch r; r.v = _mm512_loadu_pd(p); return r;}
+static inline void vstore(double *p, vbatch a) {_mm512_storeu_pd(p, a.v);}
+static inline vbatch operator+(vbatch a, vbatch b) {vbatch r; r.v = _mm512_add_pd(a.v, b.v); return r;}
+static inline vbatch operator-(vbatch a, vbatch b) {vbatch r; r.v = _mm512_sub_pd(a.v, b.v); return r;}
+static inline vbatch operator*(vbatch a, vbatch b) {vbatch r; r.v = _mm512_mul_pd(a.v, b.v); return r;}
+static inline vbatch operator/(vbatch a, vbatch b) {vbatch r; r.v = _mm512_div_pd(a.v, b.v); return r;}
+static inline vbatch vabs(vbatch a) {vbatch r; r.v = _mm512_castsi512_pd(_mm512_and_epi64(_mm512_castpd_si512(a.v), _mm512_set1_epi64(0x7FFFFFFFFFFFFFFFLL))); return r;}
+#elif defined(__AVX__)
+#include <immintrin.h>
+#define KERNEL_ISA "AVX"
+struct vbatch { __m256d v[2]; };
+#define VBATCH_OP(op, fn) static inline vbatch operator op(vbatch a, vbatch b) {vbatch r; r.v[0] = fn(a.v[0], b.v[0]); r.v[1] = fn(a.v[1], b.v[1]); return r;}
+static inline vbatch vset(double x) {vbatch r; r.v[0] = r.v[1] = _mm256_set1_pd(x); return r;}
+static inline vbatch vload(const double *p) {vbatch r; r.v[0] = _mm256_loadu_pd(p); r.v[1] = _mm256_loadu_pd(p + 4); return r;}
+static inline void vstore(double *p, vbatch a) {_mm256_storeu_pd(p, a.v[0]); _mm256_storeu_pd(p + 4, a.v[1]);}
+VBATCH_OP(+, _mm256_add_pd)
+VBATCH_OP(-, _mm256_sub_pd)
+VBATCH_OP(*, _mm256_mul_pd)
+VBATCH_OP(/, _mm256_div_pd)
+static inline vbatch vabs(vbatch a) {vbatch r; __m256d sign = _mm256_set1_pd(-0.0); r.v[0] = _mm256_andnot_pd(sign, a.v[0]); r.v[1] = _mm256_andnot_pd(sign, a.v[1]); return r;}
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define KERNEL_ISA "SSE2"
+struct vbatch { __m128d v0, v1, v2, v3; }; //separate members rather than an array so they stay in registers at -O2
+#define VBATCH_OP(op, fn) static inline vbatch operator op(vbatch a, vbatch b) {vbatch r; r.v0 = fn(a.v0, b.v0); r.v1 = fn(a.v1, b.v1); r.v2 = fn(a.v2, b.v2); r.v3 = fn(a.v3, b.v3); return r;}
+static inline vbatch vset(double x) {vbatch r; r.v0 = r.v1 = r.v2 = r.v3 = _mm_set1_pd(x); return r;}
+static inline vbatch vload(const double *p) {vbatch r; r.v0 = _mm_loadu_pd(p); r.v1 = _mm_loadu_pd(p + 2); r.v2 = _mm_loadu_pd(p + 4); r.v3 = _mm_loadu_pd(p + 6); return r;}
+static inline void vstore(double *p, vbatch a) {_mm_storeu_pd(p, a.v0); _mm_storeu_pd(p + 2, a.v1); _mm_storeu_pd(p + 4, a.v2); _mm_storeu_pd(p + 6, a.v3);}
+VBATCH_OP(+, _mm_add_pd)
+VBATCH_OP(-, _mm_sub_pd)
+VBATCH_OP(*, _mm_mul_pd)
+VBATCH_OP(/, _mm_div_pd)
+static inline vbatch vabs(vbatch a) {vbatch r; __m128d sign = _mm_set1_pd(-0.0); r.v0 = _mm_andnot_pd(sign, a.v0); r.v1 = _mm_andnot_pd(sign, a.v1); r.v2 = _mm_andnot_pd(sign, a.v2); r.v3 = _mm_andnot_pd(sign, a.v3); return r;}
+#else
+#define KERNEL_ISA "scalar"
+struct vbatch { double v[REPLAY_BATCH]; };
+#define VBATCH_OP(op) static inline vbatch operator op(vbatch a, vbatch b) {vbatch r; for(int i=0; i<REPLAY_BATCH; i++) r.v[i] = a.v[i] op b.v[i]; return r;}
+static inline vbatch vset(double x) {vbatch r; for(int i=0; i<REPLAY_BATCH; i++) r.v[i] = x; return r;}
+static inline vbatch vload(const double *p) {vbatch r; for(int i=0; i<REPLAY_BATCH; i++) r.v[i] = p[i]; return r;}
+static inline void vstore(double *p, vbatch a) {for(int i=0; i<REPLAY_BATCH; i++) p[i] = a.v[i];}
+VBATCH_OP(+)
+VBATCH_OP(-)
+VBATCH_OP(*)
+VBATCH_OP(/)
+static inline vbatch vabs(vbatch a) {vbatch r; for(int i=0; i<REPLAY_BATCH; i++) r.v[i] = qFabs(a.v[i]); return r;}
+#endif
+
+const char *ReplayKernel::instructionSet(void)
+{
+    return KERNEL_ISA;
+}
+
+//Same window and stepping as MotorTuner::replay, comments show the MotorModel member each line reproduces
+void ReplayKernel::run(const LogData *data, const log_window &window, MotorModel &motor, replay_batch *batch)
+{
+    const qint64 *time = data->times();
+    const double *id = data->channel(chan_id);
+    const double *iq = data->channel(chan_iq);
+    const double *ud = data->channel(chan_ud);
+    const double *uq = data->channel(chan_uq);
+    const double *frq = data->channel(chan_frq);
+
+    const double poles = motor.getPoles();
+    const double wheelSize = motor.getWheelSize();
+    const double ratio = motor.getGboxRatio();
+    const double mass = motor.getVehicleMass();
+    const double timestep = motor.getTimestep();
+    const double gradientForce = -(qSin(qAtan(motor.getRoadGradient()))*mass*9.81); //as MotorModel::updateGradientForce
+
+    const vbatch Rs = vload(batch->Rs);
+    const vbatch Ld = vload(batch->Ld);
+    const vbatch Lq = vload(batch->Lq);
+    const vbatch fluxLink = vload(batch->fluxLink);
+    const vbatch vPoles = vset(poles);
+    const vbatch two = vset(2);
+    const vbatch pi = vset(M_PI);
+    const vbatch torqueScale = vset((3.0/2.0) * poles);
+    const vbatch vRatio = vset(ratio);
+    const vbatch vWheelSize = vset(wheelSize);
+    const vbatch vGradientForce = vset(gradientForce);
+    const vbatch vMass = vset(mass);
+    const vbatch vTimestep = vset(timestep);
+    const vbatch wheelCirc = vset(2.0 * M_PI * wheelSize);
+    const vbatch fluxLinkPoles = fluxLink * vPoles;
+    const vbatch LdMinusLq = Ld - Lq;
+
+    vbatch frequency = vset(0); //m_Frequency
+    vbatch Vd = vset(0);
+    vbatch Vq = vset(0);
+    vbatch errVd = vset(0);
+    vbatch errVq = vset(0);
+    int rows = 0;
+    int modelSteps = 0;
+    bool started = false;
+    qint64 timenow = 0;
+
+    for(int i=window.begin; i<window.end; i++)
+    {
+        if(window.contains(time[i]))
+        {
+            if(!started)
+            {
+                timenow = time[i];
+                started = true;
+            }
+            //inputs are the same for every substep of the row
+            const vbatch Id = vset(id[i]);
+            const vbatch Iq = vset(iq[i]);
+            const vbatch speedIn = vset(((frq[i] / poles) * (2.0 * M_PI * wheelSize))/ratio); //setSpeedFromElecFreq
+            const vbatch Vd_dueto_Rd = Rs * Id;
+            const vbatch Vq_dueto_Rq = Rs * Iq;
+            const vbatch torque = torqueScale * ((fluxLink * Iq) + ((LdMinusLq * Id) * Iq));
+            const vbatch accel = ((((torque * vRatio) / vWheelSize) + vGradientForce) / vMass);
+            const vbatch frequencyOut = ((speedIn + (accel * vTimestep)) / wheelCirc) * vRatio;
+            //at most two steps per row, see MotorTuner::replay
+            qint64 steps = qMax((qint64)1, time[i+1] - timenow);
+            for(qint64 step=0; step<qMin(steps, (qint64)2); step++)
+            {
+                vbatch w = ((vPoles * frequency) * two) * pi;
+                vbatch Vq_bemf = ((fluxLinkPoles * frequency) * two) * pi;
+                Vd = Vd_dueto_Rd - ((w * Lq) * Iq);
+                Vq = (Vq_dueto_Rq + Vq_bemf) + ((w * Ld) * Id);
+                frequency = frequencyOut;
+            }
+            timenow += steps;
+            modelSteps += qMin(steps, (qint64)2);
+
+            errVd = errVd + vabs(Vd - vset(ud[i]));
+            errVq = errVq + vabs(Vq - vset(uq[i]));
+            rows++;
+        }
+    }
+
+    vstore(batch->errVd, errVd);
+    vstore(batch->errVq, errVq);
+    batch->rows = rows;
+    batch->steps = modelSteps;
+}
@@ -0,0 +1,52 @@
+/*
+ * This file is part of the IPMMotorCalc project
+ *
+ * Copyright (C) 2023 Pete9008 <openinverter.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REPLAYKERNEL_H
+#define REPLAYKERNEL_H
+
+#include "logdata.h"
+#include "motormodel.h"
+
+#define REPLAY_BATCH 8
+
+//One set of candidate parameters per lane, errors are returned per lane
+struct replay_batch {
+    double Rs[REPLAY_BATCH];
+    double Ld[REPLAY_BATCH];
+    double Lq[REPLAY_BATCH];
+    double fluxLink[REPLAY_BATCH];
+    double errVd[REPLAY_BATCH]; //sum of absolute Vd errors
+    double errVq[REPLAY_BATCH]; //sum of absolute Vq errors
+    int rows;
+    int steps; //model steps taken by each lane
+};
+
+//Replays the log once for REPLAY_BATCH candidate parameter sets at the same time, one per SIMD lane.
+//The arithmetic is MotorModel::Step/setSpeedFromElecFreq done in the same order so, unless the compiler is allowed to
+//fuse multiply-adds (e.g. -mfma or -march=native), the errors match MotorTuner::replay bit for bit. With fused
+//multiply-adds they agree to within rounding, around 1e-15 relative.
+//The instruction set is chosen at compile time, see core.pri for the avx2/avx512 CONFIG options.
+class ReplayKernel
+{
+public:
+    static void run(const LogData *data, const log_window &window, MotorModel &motor, replay_batch *batch);
+    static const char *instructionSet(void);
+};
+
+#endif // REPLAYKERNEL_H
@@ -0,0 +1,86 @@
+/*
+ * This file is part of the IPMMotorCalc project
+ *
+ * Copyright (C) 2023 Pete9008 <openinverter.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rlsestimator.h"
+#include <QtMath>
+
+//starting covariance as a ratio of the starting value, i.e. the first guesses are trusted to about ±100%
+#define RLS_INITIAL_VARIANCE 1.0
+
+RlsEstimator::RlsEstimator()
+    : m_forgetting{0.999}
+{
+    reset(0, 0, 0, 0);
+}
+
+void RlsEstimator::reset(double Rs, double Ld, double Lq, double fluxLink)
+{
+    //typical values stand in for any left at zero so the ratios still mean something
+    const double start[4] = {Rs, Ld, Lq, fluxLink};
+    const double typical[4] = {0.1, 0.001, 0.001, 0.1};
+    for(int i=0; i<4; i++)
+    {
+        m_scale[i] = (start[i] != 0) ? qFabs(start[i]) : typical[i];
+        m_theta[i] = start[i] / m_scale[i];
+        for(int j=0; j<4; j++)
+            m_P[i][j] = (i == j) ? RLS_INITIAL_VARIANCE : 0;
+    }
+    m_samples = 0;
+}
+
+//One scalar measurement y = phi.theta. The covariance is only inflated by the forgetting factor while it is below its
+//starting size, otherwise rows that don't excite a parameter (e.g. standing still) would let it wind up without limit.
+void RlsEstimator::updateRow(const double *phi, double y, double forgetting)
+{
+    double Pphi[4];
+    double denom = 0, err = y;
+    for(int i=0; i<4; i++)
+    {
+        Pphi[i] = 0;
+        for(int j=0; j<4; j++)
+            Pphi[i] += m_P[i][j] * phi[j];
+        denom += phi[i] * Pphi[i];
+        err -= phi[i] * m_theta[i];
+    }
+
+    double trace = m_P[0][0] + m_P[1][1] + m_P[2][2] + m_P[3][3];
+    double lambda = (trace < (4 * RLS_INITIAL_VARIANCE)) ? forgetting : 1.0;
+    denom += lambda;
+    for(int i=0; i<4; i++)
+        m_theta[i] += (Pphi[i] / denom) * err;
+    for(int i=0; i<4; i++)
+    {   //kept symmetric, rounding would otherwise slowly break it
+        for(int j=i; j<4; j++)
+        {
+            m_P[i][j] = (m_P[i][j] - ((Pphi[i] * Pphi[j]) / denom)) / lambda;
+            m_P[j][i] = m_P[i][j];
+        }
+    }
+}
+
+//Each row gives a Vd and a Vq equation, forgetting is applied once per row
+void RlsEstimator::update(double id, double iq, double ud, double uq, double frq)
+{
+    double w = 2 * M_PI * frq;
+    const double d[4] = {id * m_scale[0], 0, -w * iq * m_scale[2], 0};
+    const double q[4] = {iq * m_scale[0], w * id * m_scale[1], 0, w * m_scale[3]};
+    updateRow(d, ud, 1.0);
+    updateRow(q, uq, m_forgetting);
+    m_samples++;
+}
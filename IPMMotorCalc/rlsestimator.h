@@ -0,0 +1,53 @@
+/*
+ * This file is part of the IPMMotorCalc project
+ *
+ * Copyright (C) 2023 Pete9008 <openinverter.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RLSESTIMATOR_H
+#define RLSESTIMATOR_H
+
+//Recursive least squares fit of the steady state voltage equations used by MotorModel::Step
+//  Vd = Rs*Id - w*Lq*Iq
+//  Vq = Rs*Iq + w*Ld*Id + w*λ
+//updated one log row at a time at a fixed cost, so estimates can follow a live log and drift such as Rs rising with
+//temperature. Older rows are discounted by the forgetting factor each row (1 = never forget, 0.999 remembers roughly
+//the last 1000 rows). Parameters are estimated as a ratio to the starting values to keep the covariance well scaled.
+class RlsEstimator
+{
+public:
+    RlsEstimator();
+    void reset(double Rs, double Ld, double Lq, double fluxLink);
+    void setForgetting(double forgetting) {m_forgetting = forgetting;}
+    double getForgetting(void) const {return m_forgetting;}
+    void update(double id, double iq, double ud, double uq, double frq);
+    int getSamples(void) const {return m_samples;}
+    double getRs(void) const {return m_theta[0] * m_scale[0];}
+    double getLd(void) const {return m_theta[1] * m_scale[1];}
+    double getLq(void) const {return m_theta[2] * m_scale[2];}
+    double getFluxLinkage(void) const {return m_theta[3] * m_scale[3];}
+
+private:
+    void updateRow(const double *phi, double y, double forgetting);
+
+    double m_scale[4];
+    double m_theta[4];
+    double m_P[4][4];
+    double m_forgetting;
+    int m_samples;
+};
+
+#endif // RLSESTIMATOR_H
@@ -0,0 +1,181 @@
+/*
+ * This file is part of the IPMMotorCalc project
+ *
+ * Copyright (C) 2023 Pete9008 <openinverter.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "serieslod.h"
+
+#define LOD_FIRST_BUCKET 8
+
+//keep the low and high point of a bucket in the order they occur
+static void appendMinMax(QVector<int> *level, int lo, int hi)
+{
+    level->append(qMin(lo, hi));
+    level->append(qMax(lo, hi));
+}
+
+//first level, buckets of raw points from bucket onwards are (re)calculated
+static void bucketPoints(const series_view &view, QVector<int> *level, int bucket)
+{
+    int n = view.size();
+    level->resize(2 * bucket);
+    for(int b=bucket*LOD_FIRST_BUCKET; b<n; b+=LOD_FIRST_BUCKET)
+    {
+        int lo = b, hi = b;
+        double ylo = view.y(b), yhi = ylo;
+        for(int i=b+1; i<qMin(b + LOD_FIRST_BUCKET, n); i++)
+        {
+            double y = view.y(i);
+            if(y < ylo) {lo = i; ylo = y;}
+            if(y > yhi) {hi = i; yhi = y;}
+        }
+        appendMinMax(level, lo, hi);
+    }
+}
+
+//further levels merge pairs of buckets from the one below
+static void mergeLevel(const series_view &view, const QVector<int> &below, QVector<int> *level, int bucket)
+{
+    level->resize(2 * bucket);
+    for(int b=4*bucket; b<below.size(); b+=4)
+    {
+        int lo = view.y(below[b]) < view.y(below[b+1]) ? below[b] : below[b+1];
+        int hi = view.y(below[b]) < view.y(below[b+1]) ? below[b+1] : below[b];
+        if((b + 3) < below.size())
+        {
+            for(int i=b+2; i<b+4; i++)
+            {
+                if(view.y(below[i]) < view.y(lo)) lo = below[i];
+                if(view.y(below[i]) > view.y(hi)) hi = below[i];
+            }
+        }
+        appendMinMax(level, lo, hi);
+    }
+}
+
+//first index with x >= xmin (upper false) or x > xmax (upper true)
+static int searchX(const series_view &view, double x, bool upper)
+{
+    int first = 0, count = view.size();
+    while(count > 0)
+    {
+        int step = count / 2;
+        double px = view.x(first + step);
+        if(upper ? (px <= x) : (px < x))
+        {
+            first += step + 1;
+            count -= step + 1;
+        }
+        else
+            count = step;
+    }
+    return first;
+}
+
+void SeriesLod::clear(void)
+{
+    m_view = series_view{nullptr, nullptr, chan_id};
+    m_built = 0;
+    m_sorted = true;
+    m_levels.clear();
+}
+
+//brings the pyramid up to date with the series, if points have only been appended since the last call just the
+//buckets they touch are redone so the cost follows the size of the new block rather than the whole history
+void SeriesLod::build(const series_view &view)
+{
+    int n = view.size();
+    if((view != m_view) || (n < m_built))
+        clear();
+    m_view = view;
+    if(!m_sorted || (n == m_built))
+        return;
+
+    for(int i=qMax(1, m_built); i<n; i++)
+    {
+        if(view.x(i) < view.x(i-1))
+        {
+            m_sorted = false; //can't binary search it so it is always drawn in full
+            m_levels.clear();
+            return;
+        }
+    }
+    int bucket = m_levels.isEmpty() ? 0 : (m_built / LOD_FIRST_BUCKET);
+    m_built = n;
+    if(n <= LOD_FIRST_BUCKET)
+        return;
+
+    if(m_levels.isEmpty())
+        m_levels.append(QVector<int>());
+    bucketPoints(view, &m_levels[0], bucket);
+
+    //keep adding levels until there are only a few buckets left
+    for(int j=1; (j < m_levels.size()) || (m_levels.last().size() > 4); j++)
+    {
+        if(j == m_levels.size())
+        {
+            m_levels.append(QVector<int>());
+            bucket = 0;
+        }
+        else
+            bucket /= 2;
+        mergeLevel(view, m_levels.at(j-1), &m_levels[j], bucket);
+    }
+}
+
+//points to draw the series between xmin and xmax on a plot pixels wide, one point either side of the range is
+//included so the line runs off the edge of the plot rather than stopping short
+QVector<QPointF> SeriesLod::query(double xmin, double xmax, int pixels) const
+{
+    QVector<QPointF> result;
+    int n = qMin(m_view.size(), m_built);
+    if(n == 0)
+        return result;
+
+    int first = 0, last = n;
+    if(m_sorted)
+    {
+        first = qMax(0, searchX(m_view, xmin, false) - 1);
+        last = qMin(n, searchX(m_view, xmax, true) + 1);
+    }
+
+    int count = last - first;
+    pixels = qMax(pixels, 1);
+    if(!m_sorted || m_levels.isEmpty() || (count <= (2 * pixels)))
+    {
+        result.reserve(qMax(count, 0));
+        for(int i=first; i<last; i++)
+            result.append(m_view.at(i));
+        return result;
+    }
+
+    //coarsest level that still gives at least one bucket per pixel
+    int level = 0;
+    while(((level + 1) < m_levels.size()) && ((LOD_FIRST_BUCKET << (level + 1)) <= (count / pixels)))
+        level++;
+    int bucket = LOD_FIRST_BUCKET << level;
+    const QVector<int> &index = m_levels[level];
+    int b0 = first / bucket;
+    int b1 = qMin((last - 1) / bucket, (index.size() / 2) - 1);
+    result.reserve(2 * (b1 - b0 + 1));
+    for(int b=b0; b<=b1; b++)
+    {
+        result.append(m_view.at(index[2 * b]));
+        result.append(m_view.at(index[(2 * b) + 1]));
+    }
+    return result;
+}
@@ -0,0 +1,60 @@
+/*
+ * This file is part of the IPMMotorCalc project
+ *
+ * Copyright (C) 2023 Pete9008 <openinverter.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SERIESLOD_H
+#define SERIESLOD_H
+
+#include <QVector>
+#include <QPointF>
+#include "logdata.h"
+
+//What a graph series draws, either points owned by the graph or one channel of a log against time in seconds read
+//straight from the LogData so the log isn't copied.
+struct series_view {
+    const QVector<QPointF> *points;
+    const LogData *log;
+    log_channel ch;
+
+    int size(void) const {return points ? points->size() : (log ? log->size() : 0);}
+    double x(int i) const {return points ? (*points)[i].x() : (log->time(i) / 1000.0);}
+    double y(int i) const {return points ? (*points)[i].y() : log->value(ch, i);}
+    QPointF at(int i) const {return QPointF(x(i), y(i));}
+    bool operator==(const series_view &other) const {return (points == other.points) && (log == other.log) && (ch == other.ch);}
+    bool operator!=(const series_view &other) const {return !(*this == other);}
+};
+
+//Min/max level of detail pyramid over a series sorted by x. Level j splits the series into buckets of
+//(LOD_FIRST_BUCKET << j) points and keeps the index of the lowest and highest point of each, in x order, so any x
+//range can be drawn with a couple of points per pixel without losing spikes.
+class SeriesLod
+{
+public:
+    SeriesLod() : m_view{nullptr, nullptr, chan_id}, m_built{0}, m_sorted{true} {}
+    void build(const series_view &view);
+    void clear(void);
+    QVector<QPointF> query(double xmin, double xmax, int pixels) const;
+
+private:
+    series_view m_view;
+    int m_built; //points covered by the pyramid
+    bool m_sorted;
+    QVector<QVector<int> > m_levels; //two indexes per bucket
+};
+
+#endif // SERIESLOD_H
@@ -0,0 +1,49 @@
+/*
+ * This file is part of the IPMMotorCalc project
+ *
+ * Copyright (C) 2023 Pete9008 <openinverter.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TUNEJOB_H
+#define TUNEJOB_H
+
+#include <QObject>
+#include <atomic>
+#include "motortuner.h"
+
+//Passes a MotorTuner's progress back to the GUI thread as queued signals and lets the GUI cancel it
+class TuneJob : public QObject, public TuneMonitor
+{
+    Q_OBJECT
+public:
+    explicit TuneJob(QObject *parent = nullptr) : QObject(parent), m_cancel{false} {}
+    void reset(void) {m_cancel = false;}
+    bool isCancelled(void) const override {return m_cancel;}
+    void progress(int done, int total) override {emit progressChanged(done, total);}
+    void candidate(tuneParam param, double value, double error) override {emit candidateFound(param, value, error);}
+
+signals:
+    void progressChanged(int done, int total);
+    void candidateFound(int param, double value, double error);
+
+public slots:
+    void cancel(void) {m_cancel = true;}
+
+private:
+    std::atomic<bool> m_cancel;
+};
+
+#endif // TUNEJOB_H
@@ -0,0 +1,31 @@
+#-------------------------------------------------
+#
+# Microbenchmarks for the model, loader, tuner and graph hot paths
+#
+#-------------------------------------------------
+
+QT       += core gui charts widgets
+
+TARGET = IPMMotorCalcBench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+CONFIG += c++11
+
+SOURCES += \
+        main.cpp \
+    ../IPMMotorCalc/datagraph.cpp \
+    ../IPMMotorCalc/chartview.cpp \
+    ../IPMMotorCalc/chart.cpp \
+    ../IPMMotorCalc/serieslod.cpp
+
+HEADERS += \
+    ../IPMMotorCalc/datagraph.h \
+    ../IPMMotorCalc/chartview.h \
+    ../IPMMotorCalc/chart.h \
+    ../IPMMotorCalc/serieslod.h
+
+include(../IPMMotorCalc/core.pri)
@@ -0,0 +1,252 @@
+/*
+ * This file is part of the IPMMotorCalc project
+ *
+ * Copyright (C) 2023 Pete9008 <openinverter.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+#include <QTemporaryDir>
+#include <QFile>
+#include <QElapsedTimer>
+#include <QPixmap>
+#include <functional>
+#include <algorithm>
+#include "logdata.h"
+#include "motormodel.h"
+#include "motortuner.h"
+#include "errorindex.h"
+#include "replaykernel.h"
+#include "loggenerator.h"
+#include "datagraph.h"
+
+//One benchmark, body does a fixed amount of work and returns how many items (steps, rows, ...) it processed
+struct bench_case {
+    QString name;
+    QString unit;
+    std::function<qint64(void)> body;
+};
+
+//Times reps runs of the body after one warm up run and returns the median rate in items per second, the median rather
+//than the mean so one run disturbed by the rest of the machine doesn't move the result
+static double runBench(const bench_case &bench, int reps)
+{
+    bench.body();
+    QVector<double> rates;
+    for(int i=0; i<reps; i++)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        qint64 items = bench.body();
+        qint64 ns = qMax((qint64)1, timer.nsecsElapsed());
+        rates.append((items * 1e9) / ns);
+    }
+    std::sort(rates.begin(), rates.end());
+    return rates[rates.size() / 2];
+}
+
+//Synthetic log from the model itself, the generator's default profiles
+static bool writeLog(QString fileName, int rows)
+{
+    QFile file(fileName);
+    generator_options options = LogGenerator::defaultOptions();
+    options.rows = rows;
+    MotorModel motor(0.3, 6, 0, 800, 0.006, 0.002, 0.15, 4, 0.1, 0.001, 0, 1);
+    return file.open(QIODevice::WriteOnly) && LogGenerator::write(&file, motor, options);
+}
+
+int main(int argc, char *argv[])
+{
+    if(!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen"); //the graph benchmark renders to a pixmap, no display needed
+    QApplication a(argc, argv);
+    QCoreApplication::setApplicationName("IPMMotorCalcBench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Times the model, loader, tuner and graph hot paths and compares them with a stored baseline");
+    parser.addHelpOption();
+    QCommandLineOption rowsOpt("rows", "Rows in the synthetic log", "n", "200000");
+    QCommandLineOption repsOpt("reps", "Timed runs of each benchmark, the median is reported", "n", "5");
+    QCommandLineOption baselineOpt("baseline", "Baseline to compare against, written if it doesn't exist yet", "file", "bench-baseline.json");
+    QCommandLineOption thresholdOpt("threshold", "Slow down from the baseline (%) that counts as a regression", "percent", "10");
+    QCommandLineOption updateOpt("update-baseline", "Write these results as the new baseline rather than failing on regressions");
+    QCommandLineOption onlyOpt("only", "Comma separated list of benchmarks to run", "list");
+    parser.addOptions({rowsOpt, repsOpt, baselineOpt, thresholdOpt, updateOpt, onlyOpt});
+    parser.process(a);
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+    const int rows = qMax(1000, parser.value(rowsOpt).toInt());
+    const int reps = qMax(1, parser.value(repsOpt).toInt());
+    const double threshold = parser.value(thresholdOpt).toDouble();
+    const QStringList only = parser.isSet(onlyOpt) ? parser.value(onlyOpt).split(u',') : QStringList();
+
+    QTemporaryDir dir;
+    QString logName = dir.filePath("bench.csv");
+    LogData log;
+    if(!dir.isValid() || !writeLog(logName, rows) || !log.loadCsv(logName, false))
+    {
+        err << "Unable to write the synthetic log\n";
+        return 2;
+    }
+    MotorModel motor(0.3, 6, 0, 800, 0.006, 0.002, 0.15, 4, 0.1, 0.001, 0, 1);
+    QVector<double> candidates;
+    for(int i=0; i<201; i++)
+        candidates.append(0.002 * (0.5 + (i / 200.0)));
+    ErrorIndex index;
+    index.build(&log);
+
+    QList<bench_case> benches;
+    benches.append({"model_step", "steps/s", [&]()
+    {
+        MotorModel model(motor);
+        const qint64 steps = 10000000;
+        double sum = 0;
+        for(qint64 i=0; i<steps; i++)
+        {
+            if((i & 0x3ff) == 0)
+                model.setSpeedFromElecFreq(50);
+            model.Step(100 + (i & 0xff), -50);
+            sum += model.getVd();
+        }
+        volatile double sink = sum; //keep the loop
+        Q_UNUSED(sink);
+        return steps;
+    }});
+    benches.append({"csv_parse", "rows/s", [&]()
+    {
+        LogData data;
+        data.loadCsv(logName, false);
+        return (qint64)data.size();
+    }});
+    benches.append({"cache_load", "rows/s", [&]()
+    {   //the first (warm up) run writes the cache
+        LogData data;
+        data.loadCsv(logName, true);
+        return (qint64)data.size();
+    }});
+    benches.append({"replay", "rows/s", [&]()
+    {
+        MotorTuner tuner(&log);
+        MotorModel model(motor);
+        return (qint64)tuner.replay(model).rows;
+    }});
+    benches.append({"tune_evaluate", "candidates/s", [&]()
+    {
+        MotorTuner tuner(&log);
+        tuner.evaluate(motor, tune_Ld, candidates);
+        return (qint64)candidates.size();
+    }});
+    benches.append({"quick_sweep", "candidates/s", [&]()
+    {
+        MotorTuner tuner(&log);
+        tuner.setIndex(&index);
+        qint64 count = 0;
+        for(int i=0; i<1000; i++)
+        {
+            tuner.setWindow(i * 0.01, rows * 0.01);
+            count += tuner.quickSweep(motor, tune_Ld, 50).evaluations;
+        }
+        return count;
+    }});
+    benches.append({"graph_render", "points/s", [&]()
+    {   //whole log in view so every level of the min/max pyramid gets built and drawn
+        DataGraph graph("bench");
+        graph.addSeries("Id", axis_left, chan_id);
+        graph.addSeries("Iq", axis_left, chan_iq);
+        graph.addSeries("Vd", axis_left, chan_ud);
+        graph.addSeries("Vq", axis_left, chan_uq);
+        graph.addSeries("Frq", axis_right, chan_frq);
+        for(int ch=0; ch<chan_count; ch++)
+            graph.setLogView(&log, (log_channel)ch, ch);
+        graph.resize(1600, 300);
+        graph.updateGraph();
+        QPixmap pixmap = graph.grab();
+        Q_UNUSED(pixmap);
+        return (qint64)log.size() * chan_count;
+    }});
+
+    QJsonObject results;
+    for(int i=0; i<benches.size(); i++)
+    {
+        if(!only.isEmpty() && !only.contains(benches[i].name))
+            continue;
+        QJsonObject result;
+        result["rate"] = runBench(benches[i], reps);
+        result["unit"] = benches[i].unit;
+        results[benches[i].name] = result;
+    }
+
+    QFile baselineFile(parser.value(baselineOpt));
+    QJsonObject baseline;
+    bool haveBaseline = baselineFile.open(QIODevice::ReadOnly);
+    if(haveBaseline)
+    {
+        QJsonObject doc = QJsonDocument::fromJson(baselineFile.readAll()).object();
+        baselineFile.close();
+        baseline = doc["benchmarks"].toObject();
+        if(doc["rows"].toInt() != rows)
+            err << "Baseline was taken with --rows " << doc["rows"].toInt() << ", rates may not compare\n";
+    }
+
+    //rates, so higher is better and a regression is a drop of more than threshold percent
+    int regressions = 0;
+    out << QString("%1 %2 %3 %4\n").arg("benchmark", -16).arg("rate", 16).arg("baseline", 16).arg("change", 10);
+    for(QJsonObject::const_iterator it = results.constBegin(); it != results.constEnd(); ++it)
+    {
+        double rate = it.value().toObject()["rate"].toDouble();
+        QString unit = it.value().toObject()["unit"].toString();
+        QString line = QString("%1 %2").arg(it.key(), -16).arg(QString::number(rate, 'g', 4) + " " + unit, 16);
+        if(baseline.contains(it.key()))
+        {
+            double base = baseline[it.key()].toObject()["rate"].toDouble();
+            double change = (base > 0) ? (100 * (rate - base) / base) : 0;
+            bool regressed = (change < -threshold);
+            line += QString(" %1 %2%").arg(QString::number(base, 'g', 4), 16).arg(QString::number(change, 'f', 1), 9);
+            if(regressed)
+            {
+                line += "  REGRESSION";
+                regressions++;
+            }
+        }
+        out << line << "\n";
+    }
+
+    if(!haveBaseline || parser.isSet(updateOpt))
+    {
+        QJsonObject doc;
+        doc["benchmarks"] = results;
+        doc["rows"] = rows;
+        doc["instructionSet"] = QString(ReplayKernel::instructionSet());
+        if(!baselineFile.open(QIODevice::WriteOnly))
+        {
+            err << "Unable to write " << baselineFile.fileName() << "\n";
+            return 2;
+        }
+        baselineFile.write(QJsonDocument(doc).toJson(QJsonDocument::Indented));
+        out << "Baseline written to " << baselineFile.fileName() << "\n";
+        return 0;
+    }
+    if(regressions)
+    {
+        out << regressions << " benchmark(s) more than " << threshold << "% slower than the baseline\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,27 @@
+#-------------------------------------------------
+#
+# Headless front end to the IPMMotorCalc model and tuner
+#
+#-------------------------------------------------
+
+QT       += core
+QT       -= gui
+
+TARGET = IPMMotorCalcCli
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+CONFIG += c++11
+
+SOURCES += \
+        main.cpp
+
+include(../IPMMotorCalc/core.pri)
+
+# Default rules for deployment.
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
@@ -0,0 +1,480 @@
+/*
+ * This file is part of the IPMMotorCalc project
+ *
+ * Copyright (C) 2023 Pete9008 <openinverter.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QTextStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <QElapsedTimer>
+#include <limits>
+#include "logdata.h"
+#include "motormodel.h"
+#include "motortuner.h"
+#include "loggenerator.h"
+#include "perfstats.h"
+
+static bool parseTuneList(QString list, QList<tuneParam> *params)
+{
+    QStringList names = list.toLower().split(u',');
+    for(int i=0; i<names.size(); i++)
+    {
+        if(names[i].isEmpty()) continue;
+        else if(names[i] == "lq") params->append(tune_Lq);
+        else if(names[i] == "ld") params->append(tune_Ld);
+        else if(names[i] == "rs") params->append(tune_Rs);
+        else if((names[i] == "fl") || (names[i] == "flux")) params->append(tune_FL);
+        else return false;
+    }
+    return true;
+}
+
+static QJsonObject errorToJson(const replay_error &err)
+{
+    QJsonObject obj;
+    obj["rows"] = err.rows;
+    obj["vdAbsSum"] = err.vd;
+    obj["vqAbsSum"] = err.vq;
+    obj["vdAbsMean"] = err.rows ? err.vd/err.rows : 0.0;
+    obj["vqAbsMean"] = err.rows ? err.vq/err.rows : 0.0;
+    return obj;
+}
+
+static QJsonObject paramsToJson(MotorModel &motor)
+{
+    QJsonObject obj;
+    obj["Rs_mOhm"] = motor.getRs()*1000;
+    obj["Ld_mH"] = motor.getLd()*1000;
+    obj["Lq_mH"] = motor.getLq()*1000;
+    obj["fluxLinkage_mWb"] = motor.getFluxLinkage()*1000;
+    return obj;
+}
+
+//everything the command line asks for, parsed once and shared read only by every log in a batch
+struct cli_options {
+    double weight, wheel, ratio, poles; //units as the GUI fields
+    double lq, ld, rs, fl;
+    double lqDelta, ldDelta, rsDelta, flDelta;
+    double xmin, xmax;
+    QList<tuneParam> tuneList;
+    bool autoTune, lsq, search, useCache, dynamic, joint, jointFitRs, track, instant;
+    double tol, jointStep, forgetting;
+    int passes;
+    int saturationBins; //0 for fixed parameters
+};
+
+static QJsonObject tableToJson(const param_table &table)
+{
+    QJsonObject obj;
+    QJsonArray values;
+    obj["start_A"] = table.start;
+    obj["step_A"] = table.step;
+    for(int i=0; i<table.values.size(); i++)
+        values.append(table.values[i]*1000); //mH/mWb
+    obj["values"] = values;
+    return obj;
+}
+
+//Loads, fits and reports on one log. The log is only held for the duration of the call which is what bounds the memory
+//used by a batch. Returns false if the log couldn't be loaded, with the reason in the result.
+static bool processLog(QString fileName, const cli_options &opt, QJsonObject *result)
+{
+    QElapsedTimer timer;
+    timer.start();
+    (*result)["file"] = fileName;
+
+    LogData data;
+    if(!data.loadCsv(fileName, opt.useCache))
+    {
+        (*result)["error"] = QString("File does not contain required data fields. Minimum contents:Timestamp,udc,id,iq,ud,uq,fstat");
+        return false;
+    }
+
+    MotorModel motor(opt.wheel, opt.ratio, 0, opt.weight, opt.lq/1000, opt.ld/1000, opt.rs/1000, opt.poles, opt.fl/1000, 0.001, 0, 1);
+    MotorTuner tuner(&data);
+    tuner.setWindow(opt.xmin, opt.xmax);
+    tuner.setAdaptiveSearch(opt.search);
+    tuner.setSearchTolerance(opt.tol);
+    ErrorIndex index;
+    if(opt.instant)
+    {
+        index.build(&data);
+        tuner.setIndex(&index);
+    }
+
+    (*result)["logRows"] = data.size();
+    (*result)["initial"] = paramsToJson(motor);
+    (*result)["initialError"] = errorToJson(tuner.replay(motor));
+
+    if(opt.lsq)
+    {
+        lsq_result lsq = tuner.leastSquares();
+        QJsonObject lsqObj;
+        lsqObj["valid"] = lsq.valid;
+        lsqObj["rows"] = lsq.rows;
+        lsqObj["rmsVd"] = lsq.rmsVd;
+        lsqObj["rmsVq"] = lsq.rmsVq;
+        (*result)["leastSquares"] = lsqObj;
+        if(lsq.valid)
+        {
+            motor.setRs(lsq.Rs);
+            motor.setLd(lsq.Ld);
+            motor.setLq(lsq.Lq);
+            motor.setFluxLinkage(lsq.fluxLink);
+        }
+    }
+
+    if(opt.track)
+    {   //reported only, starting from the initial guesses
+        RlsEstimator rls;
+        rls.reset(motor.getRs(), motor.getLd(), motor.getLq(), motor.getFluxLinkage());
+        rls.setForgetting(opt.forgetting);
+        tuner.track(rls);
+        QJsonObject trackObj;
+        trackObj["rows"] = rls.getSamples();
+        trackObj["Rs_mOhm"] = rls.getRs()*1000;
+        trackObj["Ld_mH"] = rls.getLd()*1000;
+        trackObj["Lq_mH"] = rls.getLq()*1000;
+        trackObj["fluxLinkage_mWb"] = rls.getFluxLinkage()*1000;
+        (*result)["tracked"] = trackObj;
+    }
+
+    for(int i=0; i<opt.tuneList.size(); i++)
+    {
+        double delta;
+        switch(opt.tuneList[i])
+        {
+        case tune_Lq: delta = opt.lqDelta; break;
+        case tune_Ld: delta = opt.ldDelta; break;
+        case tune_Rs: delta = opt.rsDelta; break;
+        case tune_FL: default: delta = opt.flDelta; break;
+        }
+        sweep_result sweep = opt.instant ? tuner.quickSweep(motor, opt.tuneList[i], delta) : tuner.tune(motor, opt.tuneList[i], delta);
+        MotorTuner::setParam(motor, opt.tuneList[i], sweep.best);
+    }
+    if(opt.autoTune)
+        tuner.autoTune(motor, opt.flDelta, opt.ldDelta, opt.lqDelta, opt.passes);
+    if(opt.joint)
+    {
+        joint_result joint = tuner.jointTune(motor, opt.jointStep, opt.tol, 1000, opt.jointFitRs);
+        QJsonObject jointObj;
+        jointObj["converged"] = joint.converged;
+        jointObj["iterations"] = joint.iterations;
+        jointObj["evaluations"] = joint.evaluations;
+        jointObj["elapsedMs"] = joint.elapsedMs;
+        jointObj["error"] = joint.error;
+        (*result)["joint"] = jointObj;
+    }
+    if(opt.saturationBins > 0)
+    {   //last as the maps take over from the fitted Ld, Lq and flux linkage
+        saturation_result sat = tuner.fitSaturation(opt.saturationBins, opt.saturationBins);
+        QJsonObject satObj;
+        satObj["valid"] = sat.valid;
+        satObj["rows"] = sat.rows;
+        satObj["usedBins"] = sat.usedBins;
+        satObj["rms"] = sat.rms;
+        if(sat.valid)
+        {
+            satObj["Rs_mOhm"] = sat.Rs*1000;
+            satObj["Ld_mH"] = tableToJson(sat.Ld);
+            satObj["Lq_mH"] = tableToJson(sat.Lq);
+            satObj["fluxLinkage_mWb"] = tableToJson(sat.fluxLink);
+            motor.setRs(sat.Rs);
+            motor.setSaturationMaps(sat.Ld, sat.Lq, sat.fluxLink);
+        }
+        (*result)["saturation"] = satObj;
+    }
+
+    (*result)["fitted"] = paramsToJson(motor);
+    (*result)["fittedError"] = errorToJson(tuner.replay(motor));
+    if(opt.dynamic)
+    {
+        replay_error dyn = tuner.replayDynamic(motor);
+        QJsonObject dynObj;
+        dynObj["rows"] = dyn.rows;
+        dynObj["idAbsMean"] = dyn.rows ? dyn.id/dyn.rows : 0.0;
+        dynObj["iqAbsMean"] = dyn.rows ? dyn.iq/dyn.rows : 0.0;
+        dynObj["integratorSteps"] = (qint64)motor.getDynamicSteps();
+        (*result)["dynamicError"] = dynObj;
+    }
+    (*result)["elapsedMs"] = timer.elapsed();
+    return true;
+}
+
+//quoted for CSV, embedded quotes are doubled (file names and Qt error strings can contain them)
+static QString csvField(QString text)
+{
+    return "\"" + text.replace("\"", "\"\"") + "\"";
+}
+
+//one line per log of the batch, fitted parameters and the mean absolute voltage errors before and after
+static void writeTable(QTextStream &out, const QJsonArray &files)
+{
+    out << "file,logRows,Rs_mOhm,Ld_mH,Lq_mH,fluxLinkage_mWb,initialVdAbsMean,initialVqAbsMean,fittedVdAbsMean,fittedVqAbsMean,elapsedMs,error\n";
+    for(int i=0; i<files.size(); i++)
+    {
+        QJsonObject f = files[i].toObject();
+        QJsonObject fitted = f["fitted"].toObject();
+        QJsonObject initialError = f["initialError"].toObject();
+        QJsonObject fittedError = f["fittedError"].toObject();
+        out << csvField(f["file"].toString()) << "," << f["logRows"].toInt() << ","
+            << fitted["Rs_mOhm"].toDouble() << "," << fitted["Ld_mH"].toDouble() << ","
+            << fitted["Lq_mH"].toDouble() << "," << fitted["fluxLinkage_mWb"].toDouble() << ","
+            << initialError["vdAbsMean"].toDouble() << "," << initialError["vqAbsMean"].toDouble() << ","
+            << fittedError["vdAbsMean"].toDouble() << "," << fittedError["vqAbsMean"].toDouble() << ","
+            << f["elapsedMs"].toDouble() << "," << csvField(f["error"].toString()) << "\n";
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("IPMMotorCalcCli");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Replays an OpenInverter CSV log through the IPM motor model, optionally tunes the model parameters and prints the result as JSON.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("files", "OpenInverter CSV logs (Timestamp,udc,id,iq,ud,uq,fstat) or folders of them, more than one log is a batch");
+    //defaults match the defaults in mainwindow.ui, units match the GUI fields
+    QCommandLineOption weightOpt("weight", "Vehicle weight (kg)", "kg", "800");
+    QCommandLineOption wheelOpt("wheel", "Wheel radius (m)", "m", "0.3");
+    QCommandLineOption ratioOpt("ratio", "Gear ratio", "ratio", "6");
+    QCommandLineOption polesOpt("poles", "Motor pole pairs", "poles", "4");
+    QCommandLineOption lqOpt("lq", "Lq guess (mH)", "mH", "6");
+    QCommandLineOption ldOpt("ld", "Ld guess (mH)", "mH", "2");
+    QCommandLineOption rsOpt("rs", "Rs guess (mOhm)", "mOhm", "150");
+    QCommandLineOption flOpt("fl", "Flux linkage guess (mWeber)", "mWb", "100");
+    QCommandLineOption lqDeltaOpt("lq-delta", "Lq sweep range (%)", "percent", "50");
+    QCommandLineOption ldDeltaOpt("ld-delta", "Ld sweep range (%)", "percent", "50");
+    QCommandLineOption rsDeltaOpt("rs-delta", "Rs sweep range (%)", "percent", "50");
+    QCommandLineOption flDeltaOpt("fl-delta", "Flux linkage sweep range (%)", "percent", "50");
+    QCommandLineOption xminOpt("xmin", "Start of the tuning window (s)", "s");
+    QCommandLineOption xmaxOpt("xmax", "End of the tuning window (s)", "s");
+    QCommandLineOption tuneOpt("tune", "Comma separated list of parameters (rs,fl,ld,lq) to tune in order, each best fit is copied before the next", "list");
+    QCommandLineOption autoTuneOpt("autotune", "Tune FL, Ld then Lq one at a time for --passes passes (the AutoTune button now does --joint 10 --fixed-rs)");
+    QCommandLineOption lsqOpt("lsq", "Start from the direct least squares fit of all four parameters");
+    QCommandLineOption searchOpt("search", "Use the adaptive golden section search instead of the 201 point sweep");
+    QCommandLineOption tolOpt("tol", "Adaptive search and joint fit tolerance as a fraction of the starting value", "fraction", "0.0001");
+    QCommandLineOption jointOpt("joint", "Fit all four parameters together with a Nelder-Mead simplex, initial step in percent", "percent");
+    QCommandLineOption fixedRsOpt("fixed-rs", "Hold Rs at --rs during --joint and fit the other three, as the AutoTune button does");
+    QCommandLineOption noCacheOpt("no-cache", "Always parse the CSV, don't read or write the .ipmcache sidecar");
+    QCommandLineOption dynamicOpt("dynamic", "Also replay the fitted model with the dynamic current model and report the current errors");
+    QCommandLineOption passesOpt("passes", "Number of AutoTune passes", "n", "4");
+    QCommandLineOption trackOpt("track", "Report the online (recursive least squares) estimates at the end of the window, with this forgetting factor", "factor");
+    QCommandLineOption instantOpt("instant", "Tune --tune parameters from the steady state voltage equations rather than replays");
+    QCommandLineOption saturationOpt("saturation", "Finish with Ld(Id), Lq(Iq) and flux linkage(Iq) tables of this many points each, the fitted error then uses them", "points");
+    QCommandLineOption jobsOpt("jobs", "Logs fitted at once in a batch, each one is held in memory while it is fitted", "n",
+                               QString::number(qMin(4, QThread::idealThreadCount())));
+    QCommandLineOption generateOpt("generate", "Write a synthetic log from the model with the parameters given instead of fitting logs", "file");
+    QCommandLineOption rowsOpt("rows", "Rows to generate", "n");
+    QCommandLineOption intervalOpt("interval", "Time between generated rows (ms)", "ms");
+    QCommandLineOption udcOpt("udc", "DC bus voltage of the generated log (V)", "V");
+    QCommandLineOption startFrqOpt("start-frq", "Electrical frequency at the start of the generated log (Hz)", "Hz");
+    QCommandLineOption idProfileOpt("id-profile", "Generated Id as shape:offset,amplitude,period with shape constant, sine, square or triangle (A, s)", "profile");
+    QCommandLineOption iqProfileOpt("iq-profile", "Generated Iq, as --id-profile", "profile");
+    QCommandLineOption noiseOpt("noise", "Noise added to the generated ud/uq (V rms)", "V");
+    QCommandLineOption currentNoiseOpt("current-noise", "Noise added to the generated id/iq (A rms)", "A");
+    QCommandLineOption seedOpt("seed", "Noise seed, the same seed gives the same log", "n");
+    QCommandLineOption csvOpt("csv", "Print a batch as a CSV table, one line per log, rather than JSON");
+    parser.addOptions({weightOpt, wheelOpt, ratioOpt, polesOpt, lqOpt, ldOpt, rsOpt, flOpt,
+                       lqDeltaOpt, ldDeltaOpt, rsDeltaOpt, flDeltaOpt, xminOpt, xmaxOpt,
+                       tuneOpt, autoTuneOpt, lsqOpt, searchOpt, tolOpt, jointOpt, fixedRsOpt, noCacheOpt, dynamicOpt, passesOpt, trackOpt,
+                       instantOpt, saturationOpt, jobsOpt, csvOpt,
+                       generateOpt, rowsOpt, intervalOpt, udcOpt, startFrqOpt, idProfileOpt, iqProfileOpt, noiseOpt, currentNoiseOpt, seedOpt});
+#ifdef IPM_PERFSTATS
+    QCommandLineOption perfOpt("perf", "Write the phase timers and counters to this file as JSON when done", "file");
+    parser.addOption(perfOpt);
+#endif
+    parser.process(a);
+
+    QTextStream err(stderr);
+    if(parser.isSet(generateOpt))
+    {   //the parameter options are the true values of the log, what's written and with what goes to stdout as JSON
+        generator_options gen = LogGenerator::defaultOptions();
+        if(parser.isSet(rowsOpt)) gen.rows = parser.value(rowsOpt).toLongLong();
+        if(parser.isSet(intervalOpt)) gen.intervalMs = qMax(1, parser.value(intervalOpt).toInt());
+        if(parser.isSet(udcOpt)) gen.udc = parser.value(udcOpt).toDouble();
+        if(parser.isSet(startFrqOpt)) gen.startFrq = parser.value(startFrqOpt).toDouble();
+        if(parser.isSet(noiseOpt)) gen.voltageNoise = parser.value(noiseOpt).toDouble();
+        if(parser.isSet(currentNoiseOpt)) gen.currentNoise = parser.value(currentNoiseOpt).toDouble();
+        if(parser.isSet(seedOpt)) gen.seed = parser.value(seedOpt).toUInt();
+        if((parser.isSet(idProfileOpt) && !LogGenerator::parseProfile(parser.value(idProfileOpt), &gen.id)) ||
+           (parser.isSet(iqProfileOpt) && !LogGenerator::parseProfile(parser.value(iqProfileOpt), &gen.iq)))
+        {
+            err << "Bad current profile, expected shape:offset,amplitude,period e.g. sine:-50,40,6\n";
+            return 1;
+        }
+
+        MotorModel truth(parser.value(wheelOpt).toDouble(), parser.value(ratioOpt).toDouble(), 0, parser.value(weightOpt).toDouble(),
+                         parser.value(lqOpt).toDouble()/1000, parser.value(ldOpt).toDouble()/1000, parser.value(rsOpt).toDouble()/1000,
+                         parser.value(polesOpt).toDouble(), parser.value(flOpt).toDouble()/1000, 0.001, 0, 1);
+        QElapsedTimer timer;
+        timer.start();
+        QFile file(parser.value(generateOpt));
+        if(!file.open(QIODevice::WriteOnly) || !LogGenerator::write(&file, truth, gen))
+        {
+            err << "Unable to write " << file.fileName() << "\n";
+            return 2;
+        }
+
+        QJsonObject result;
+        result["file"] = file.fileName();
+        result["rows"] = gen.rows;
+        result["bytes"] = file.size();
+        result["truth"] = paramsToJson(truth);
+        result["weight"] = truth.getVehicleMass();
+        result["ratio"] = truth.getGboxRatio();
+        result["intervalMs"] = gen.intervalMs;
+        result["voltageNoise"] = gen.voltageNoise;
+        result["currentNoise"] = gen.currentNoise;
+        result["seed"] = (qint64)gen.seed;
+        result["elapsedMs"] = timer.elapsed();
+        QTextStream(stdout) << QJsonDocument(result).toJson(QJsonDocument::Indented);
+        return 0;
+    }
+
+    QStringList files;
+    const QStringList args = parser.positionalArguments();
+    bool batch = (args.size() > 1);
+    for(int i=0; i<args.size(); i++)
+    {
+        QFileInfo info(args[i]);
+        if(info.isDir())
+        {
+            batch = true;
+            QDir dir(args[i]);
+            const QStringList logs = dir.entryList(QStringList() << "*.csv" << "*.CSV", QDir::Files, QDir::Name);
+            for(int j=0; j<logs.size(); j++)
+                files.append(dir.filePath(logs[j]));
+        }
+        else
+            files.append(args[i]);
+    }
+    if(files.isEmpty())
+    {
+        err << "At least one log file must be given\n";
+        return 1;
+    }
+
+    cli_options opt;
+    if(parser.isSet(tuneOpt) && !parseTuneList(parser.value(tuneOpt), &opt.tuneList))
+    {
+        err << "Unknown parameter in --tune, expected rs,fl,ld,lq\n";
+        return 1;
+    }
+    opt.weight = parser.value(weightOpt).toDouble();
+    opt.wheel = parser.value(wheelOpt).toDouble();
+    opt.ratio = parser.value(ratioOpt).toDouble();
+    opt.poles = parser.value(polesOpt).toDouble();
+    opt.lq = parser.value(lqOpt).toDouble();
+    opt.ld = parser.value(ldOpt).toDouble();
+    opt.rs = parser.value(rsOpt).toDouble();
+    opt.fl = parser.value(flOpt).toDouble();
+    opt.lqDelta = parser.value(lqDeltaOpt).toDouble();
+    opt.ldDelta = parser.value(ldDeltaOpt).toDouble();
+    opt.rsDelta = parser.value(rsDeltaOpt).toDouble();
+    opt.flDelta = parser.value(flDeltaOpt).toDouble();
+    opt.xmin = parser.isSet(xminOpt) ? parser.value(xminOpt).toDouble() : std::numeric_limits<double>::lowest()/1000;
+    opt.xmax = parser.isSet(xmaxOpt) ? parser.value(xmaxOpt).toDouble() : std::numeric_limits<double>::max()/1000;
+    opt.autoTune = parser.isSet(autoTuneOpt);
+    opt.lsq = parser.isSet(lsqOpt);
+    opt.search = parser.isSet(searchOpt);
+    opt.useCache = !parser.isSet(noCacheOpt);
+    opt.dynamic = parser.isSet(dynamicOpt);
+    opt.joint = parser.isSet(jointOpt);
+    opt.jointFitRs = !parser.isSet(fixedRsOpt);
+    opt.jointStep = parser.value(jointOpt).toDouble();
+    opt.track = parser.isSet(trackOpt);
+    opt.instant = parser.isSet(instantOpt);
+    bool forgettingOk;
+    opt.forgetting = parser.value(trackOpt).toDouble(&forgettingOk);
+    if(opt.track && (!forgettingOk || !(opt.forgetting > 0) || (opt.forgetting > 1)))
+    {   //0 divides by zero in the estimator and above 1 the covariance grows every row
+        err << "Bad forgetting factor in --track, expected a number in (0, 1] e.g. 0.999\n";
+        return 1;
+    }
+    opt.tol = parser.value(tolOpt).toDouble();
+    opt.passes = parser.value(passesOpt).toInt();
+    opt.saturationBins = parser.isSet(saturationOpt) ? parser.value(saturationOpt).toInt() : 0;
+
+    QTextStream out(stdout);
+    if(!batch)
+    {
+        QJsonObject result;
+        if(!processLog(files[0], opt, &result))
+        {
+            err << result["error"].toString() << "\n";
+            return 2;
+        }
+        out << QJsonDocument(result).toJson(QJsonDocument::Indented);
+#ifdef IPM_PERFSTATS
+        if(parser.isSet(perfOpt))
+            PerfStats::dump(parser.value(perfOpt));
+#endif
+        return 0;
+    }
+
+    //Logs are fitted a few at a time on their own pool so only that many are in memory at once, the replays inside each
+    //fit still spread over the global pool so the cores stay busy even with a single job
+    QThreadPool pool;
+    pool.setMaxThreadCount(qMax(1, parser.value(jobsOpt).toInt()));
+    QList<QFuture<QJsonObject> > results;
+    for(int i=0; i<files.size(); i++)
+    {
+        QString fileName = files[i];
+        results.append(QtConcurrent::run(&pool, [fileName, &opt]()
+        {
+            QJsonObject result;
+            processLog(fileName, opt, &result);
+            return result;
+        }));
+    }
+
+    QJsonArray table;
+    int failed = 0;
+    for(int i=0; i<results.size(); i++)
+    {
+        QJsonObject result = results[i].result();
+        if(result.contains("error"))
+            failed++;
+        table.append(result);
+    }
+
+    if(parser.isSet(csvOpt))
+        writeTable(out, table);
+    else
+    {
+        QJsonObject summary;
+        summary["files"] = table;
+        summary["failed"] = failed;
+        out << QJsonDocument(summary).toJson(QJsonDocument::Indented);
+    }
+#ifdef IPM_PERFSTATS
+    if(parser.isSet(perfOpt))
+        PerfStats::dump(parser.value(perfOpt));
+#endif
+    return failed ? 2 : 0;
+}